@@ -0,0 +1,754 @@
+// APU.cpp
+#include "APU.h"
+#include "Memory.h"
+#include "SaveState.h"
+#include <algorithm>
+#include <limits>
+
+static const uint8_t LENGTH_TABLE[32] = {
+    10, 254, 20,  2, 40,  4, 80,  6, 160,  8, 60, 10, 14, 12, 26, 14,
+    12,  16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30
+};
+
+static const uint8_t DUTY_TABLE[4][8] = {
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 0, 0, 0, 0, 0 },
+    { 0, 1, 1, 1, 1, 0, 0, 0 },
+    { 1, 0, 0, 1, 1, 1, 1, 1 }
+};
+
+static const uint8_t TRIANGLE_TABLE[32] = {
+    15, 14, 13, 12, 11, 10,  9,  8,  7,  6,  5,  4,  3,  2,  1,  0,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15
+};
+
+// NTSC timer periods in CPU cycles
+static const uint16_t NOISE_PERIODS[16] = {
+    4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068
+};
+static const uint16_t DMC_PERIODS[16] = {
+    428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54
+};
+
+// Frame counter sequence in CPU cycles from the last reset or wrap
+static const int FRAME_QUARTER = 1;
+static const int FRAME_HALF = 2;
+static const int FRAME_IRQ = 4;
+static const uint32_t FRAME_STEP_CYCLES[2][5] = {
+    { 7457, 14913, 22371, 29829, 0 },
+    { 7457, 14913, 22371, 29829, 37281 }
+};
+static const uint8_t FRAME_STEP_EVENTS[2][5] = {
+    { FRAME_QUARTER, FRAME_QUARTER | FRAME_HALF, FRAME_QUARTER, FRAME_QUARTER | FRAME_HALF | FRAME_IRQ, 0 },
+    { FRAME_QUARTER, FRAME_QUARTER | FRAME_HALF, FRAME_QUARTER, 0, FRAME_QUARTER | FRAME_HALF }
+};
+static const int FRAME_STEP_COUNT[2] = { 4, 5 };
+static const uint32_t FRAME_PERIOD[2] = { 29830, 37282 };
+
+// Longest channel timer period in CPU cycles (pulse, timer $7FF)
+static const uint64_t MAX_TIMER_PERIOD = 4096;
+
+// Linear approximation of the 2A03 mixer, in sample units per output step
+static const int PULSE_SCALE = 226;
+static const int TRIANGLE_SCALE = 255;
+static const int NOISE_SCALE = 148;
+static const int DMC_SCALE = 101;
+
+void APU::Envelope::Clock() {
+    if (start) {
+        start = false;
+        decay = 15;
+        divider = period;
+    }
+    else if (divider == 0) {
+        divider = period;
+        if (decay > 0) {
+            decay--;
+        }
+        else if (loop) {
+            decay = 15;
+        }
+    }
+    else {
+        divider--;
+    }
+}
+
+int APU::Envelope::Volume() const {
+    return constant ? period : decay;
+}
+
+int APU::Pulse::SweepTarget() const {
+    int change = timer >> sweepShift;
+    if (sweepNegate) {
+        return timer - change - (onesComplement ? 1 : 0);
+    }
+    return timer + change;
+}
+
+bool APU::Pulse::Muted() const {
+    return length == 0 || timer < 8 || SweepTarget() > 0x7FF;
+}
+
+void APU::Pulse::ClockSweep() {
+    if (sweepDivider == 0 && sweepEnabled && sweepShift > 0 && !Muted()) {
+        timer = (uint16_t)std::max(SweepTarget(), 0);
+    }
+    if (sweepDivider == 0 || sweepReload) {
+        sweepDivider = sweepPeriod;
+        sweepReload = false;
+    }
+    else {
+        sweepDivider--;
+    }
+}
+
+APU::APU()
+    : irq(false), cpuClock(nullptr), memory(nullptr), sampleRate(0), resampleRatio(1.0), outputSuspended(false) {
+    SetSampleRate(44100);
+    Reset();
+}
+
+void APU::Reset() {
+    pulse[0] = Pulse();
+    pulse[1] = Pulse();
+    pulse[0].onesComplement = true;
+    triangle = Triangle();
+    noise = Noise();
+    noise.shift = 1;
+    dmc = DMC();
+    dmc.bitsRemaining = 8;
+    dmc.silence = true;
+
+    fiveStep = false;
+    irqInhibit = false;
+    frameIrq = false;
+    frameStep = 0;
+    frameStart = 0;
+    cycle = 0;
+    irq = false;
+
+    blip.Clear();
+    blipFrameStart = 0;
+
+    UpdateFrameStep();
+    UpdateNextEvent();
+}
+
+void APU::ConnectClock(const uint64_t* cpuCycles) {
+    cpuClock = cpuCycles;
+}
+
+void APU::ConnectMemory(Memory* memory) {
+    this->memory = memory;
+}
+
+void APU::SetSampleRate(int rate) {
+    sampleRate = rate;
+    if (rate > 0) {
+        blip.SetRates(CPU_CLOCK_RATE, rate * resampleRatio);
+    }
+    blip.Clear();
+}
+
+void APU::SetResampleRatio(double ratio) {
+    resampleRatio = ratio;
+    if (sampleRate > 0) {
+        blip.SetRates(CPU_CLOCK_RATE, sampleRate * ratio);
+    }
+}
+
+void APU::SuspendOutput() {
+    Sync();
+    suspendedOutput[0] = pulse[0].output;
+    suspendedOutput[1] = pulse[1].output;
+    suspendedOutput[2] = triangle.output;
+    suspendedOutput[3] = noise.output;
+    suspendedOutput[4] = dmc.output;
+    outputSuspended = true;
+}
+
+void APU::ResumeOutput() {
+    Sync();
+    pulse[0].output = suspendedOutput[0];
+    pulse[1].output = suspendedOutput[1];
+    triangle.output = suspendedOutput[2];
+    noise.output = suspendedOutput[3];
+    dmc.output = suspendedOutput[4];
+    outputSuspended = false;
+}
+
+int APU::SampleRate() const {
+    return sampleRate;
+}
+
+int APU::SamplesAvailable() const {
+    return blip.SamplesAvailable();
+}
+
+int APU::ReadSamples(int16_t* out, int count) {
+    return blip.ReadSamples(out, count);
+}
+
+// Runs the APU up to the current CPU cycle
+void APU::Sync() {
+    if (!cpuClock) {
+        return;
+    }
+    Run(*cpuClock);
+    UpdateNextEvent();
+}
+
+void APU::EndFrame() {
+    Sync();
+    if (sampleRate > 0 && !outputSuspended) {
+        blip.EndFrame((uint32_t)(cycle - blipFrameStart));
+    }
+    blipFrameStart = cycle;
+}
+
+void APU::SaveEnvelope(StateWriter& state, const Envelope& envelope) {
+    state.Write(envelope.start);
+    state.Write(envelope.loop);
+    state.Write(envelope.constant);
+    state.Write(envelope.period);
+    state.Write(envelope.divider);
+    state.Write(envelope.decay);
+}
+
+void APU::LoadEnvelope(StateReader& state, Envelope& envelope) {
+    state.Read(envelope.start);
+    state.Read(envelope.loop);
+    state.Read(envelope.constant);
+    state.Read(envelope.period);
+    state.Read(envelope.divider);
+    state.Read(envelope.decay);
+}
+
+void APU::SaveState(StateWriter& state) const {
+    for (const Pulse& p : pulse) {
+        SaveEnvelope(state, p.envelope);
+        state.Write(p.duty);
+        state.Write(p.sequence);
+        state.Write(p.timer);
+        state.Write(p.length);
+        state.Write(p.enabled);
+        state.Write(p.sweepEnabled);
+        state.Write(p.sweepNegate);
+        state.Write(p.sweepReload);
+        state.Write(p.sweepPeriod);
+        state.Write(p.sweepShift);
+        state.Write(p.sweepDivider);
+        state.Write(p.nextClock);
+    }
+
+    state.Write(triangle.sequence);
+    state.Write(triangle.timer);
+    state.Write(triangle.length);
+    state.Write(triangle.enabled);
+    state.Write(triangle.control);
+    state.Write(triangle.linearReload);
+    state.Write(triangle.linearCounter);
+    state.Write(triangle.linearReloadFlag);
+    state.Write(triangle.nextClock);
+
+    SaveEnvelope(state, noise.envelope);
+    state.Write(noise.mode);
+    state.Write(noise.periodIndex);
+    state.Write(noise.shift);
+    state.Write(noise.length);
+    state.Write(noise.enabled);
+    state.Write(noise.nextClock);
+
+    state.Write(dmc.irqEnabled);
+    state.Write(dmc.loop);
+    state.Write(dmc.rateIndex);
+    state.Write(dmc.level);
+    state.Write(dmc.sampleAddr);
+    state.Write(dmc.sampleLength);
+    state.Write(dmc.currentAddr);
+    state.Write(dmc.bytesRemaining);
+    state.Write(dmc.sampleBuffer);
+    state.Write(dmc.bufferFull);
+    state.Write(dmc.shift);
+    state.Write(dmc.bitsRemaining);
+    state.Write(dmc.silence);
+    state.Write(dmc.irqFlag);
+    state.Write(dmc.nextClock);
+
+    state.Write(fiveStep);
+    state.Write(irqInhibit);
+    state.Write(frameIrq);
+    state.Write(frameStep);
+    state.Write(frameStart);
+    state.Write(cycle);
+}
+
+void APU::LoadState(StateReader& state) {
+    // Output levels are not part of the state: each channel's next run
+    // steps from what is currently playing to the loaded level.
+    //
+    // States are saved synced: the APU sits at the CPU's cycle, every timer
+    // fires within one period after it and the frame sequence started
+    // within one sequence before it. Anything else is corrupt and would
+    // send Run() into an endless catch-up.
+    const uint64_t none = std::numeric_limits<uint64_t>::max();
+    const uint64_t now = cpuClock ? *cpuClock : 0;
+    const uint64_t latest = cpuClock ? now + MAX_TIMER_PERIOD : none;
+    const uint64_t sequenceStart = now > FRAME_PERIOD[1] ? now - FRAME_PERIOD[1] : 0;
+    for (Pulse& p : pulse) {
+        LoadEnvelope(state, p.envelope);
+        state.ReadRange<uint8_t>(p.duty, 0, 3);
+        state.ReadRange<uint8_t>(p.sequence, 0, 7);
+        state.Read(p.timer);
+        state.Read(p.length);
+        state.Read(p.enabled);
+        state.Read(p.sweepEnabled);
+        state.Read(p.sweepNegate);
+        state.Read(p.sweepReload);
+        state.Read(p.sweepPeriod);
+        state.ReadRange<uint8_t>(p.sweepShift, 0, 7);
+        state.Read(p.sweepDivider);
+        state.ReadRange(p.nextClock, now, latest);
+    }
+
+    state.ReadRange<uint8_t>(triangle.sequence, 0, 31);
+    state.Read(triangle.timer);
+    state.Read(triangle.length);
+    state.Read(triangle.enabled);
+    state.Read(triangle.control);
+    state.Read(triangle.linearReload);
+    state.Read(triangle.linearCounter);
+    state.Read(triangle.linearReloadFlag);
+    state.ReadRange(triangle.nextClock, now, latest);
+
+    LoadEnvelope(state, noise.envelope);
+    state.Read(noise.mode);
+    state.ReadRange<uint8_t>(noise.periodIndex, 0, 15);
+    state.Read(noise.shift);
+    state.Read(noise.length);
+    state.Read(noise.enabled);
+    state.ReadRange(noise.nextClock, now, latest);
+
+    state.Read(dmc.irqEnabled);
+    state.Read(dmc.loop);
+    state.ReadRange<uint8_t>(dmc.rateIndex, 0, 15);
+    state.Read(dmc.level);
+    state.Read(dmc.sampleAddr);
+    state.Read(dmc.sampleLength);
+    state.Read(dmc.currentAddr);
+    state.Read(dmc.bytesRemaining);
+    state.Read(dmc.sampleBuffer);
+    state.Read(dmc.bufferFull);
+    state.Read(dmc.shift);
+    state.ReadRange<uint8_t>(dmc.bitsRemaining, 1, 8);
+    state.Read(dmc.silence);
+    state.Read(dmc.irqFlag);
+    state.ReadRange(dmc.nextClock, now, latest);
+
+    state.Read(fiveStep);
+    state.Read(irqInhibit);
+    state.Read(frameIrq);
+    state.ReadRange(frameStep, 0, FRAME_STEP_COUNT[fiveStep] - 1);
+    state.ReadRange(frameStart, sequenceStart, cpuClock ? now : none);
+    state.ReadRange(cycle, now, cpuClock ? now : none);
+
+    // The open audio frame restarts here
+    blipFrameStart = cycle;
+
+    UpdateFrameStep();
+    UpdateIRQ();
+    UpdateNextEvent();
+}
+
+void APU::Run(uint64_t target) {
+    while (cycle < target) {
+        uint64_t end = std::min(target, nextFrameStep);
+
+        RunPulse(pulse[0], end);
+        RunPulse(pulse[1], end);
+        RunTriangle(end);
+        RunNoise(end);
+        RunDMC(end);
+        cycle = end;
+
+        if (cycle == nextFrameStep) {
+            ClockFrameStep();
+        }
+    }
+}
+
+void APU::UpdateOutput(int& output, int level, int scale, uint64_t time) {
+    int value = level * scale;
+    if (value != output) {
+        if (sampleRate > 0 && !outputSuspended) {
+            blip.AddDelta((uint32_t)(time - blipFrameStart), value - output);
+        }
+        output = value;
+    }
+}
+
+// Each Run* first applies any level change made since the last run (a
+// register write or frame counter clock at 'cycle'), then steps the timer
+// through every expiry before 'end'
+void APU::RunPulse(Pulse& p, uint64_t end) {
+    int volume = p.Muted() ? 0 : p.envelope.Volume();
+    UpdateOutput(p.output, DUTY_TABLE[p.duty][p.sequence] ? volume : 0, PULSE_SCALE, cycle);
+
+    if (p.nextClock >= end) {
+        return;
+    }
+
+    uint64_t period = (p.timer + 1) * 2;
+    if (volume == 0) {
+        // Silent: only the sequencer position matters
+        uint64_t steps = (end - p.nextClock + period - 1) / period;
+        p.sequence = (uint8_t)((p.sequence + steps) & 7);
+        p.nextClock += steps * period;
+        return;
+    }
+
+    const uint8_t* duty = DUTY_TABLE[p.duty];
+    while (p.nextClock < end) {
+        p.sequence = (p.sequence + 1) & 7;
+        UpdateOutput(p.output, duty[p.sequence] ? volume : 0, PULSE_SCALE, p.nextClock);
+        p.nextClock += period;
+    }
+}
+
+void APU::RunTriangle(uint64_t end) {
+    UpdateOutput(triangle.output, TRIANGLE_TABLE[triangle.sequence], TRIANGLE_SCALE, cycle);
+
+    if (triangle.nextClock >= end) {
+        return;
+    }
+
+    uint64_t period = triangle.timer + 1;
+    if (triangle.length == 0 || triangle.linearCounter == 0 || triangle.timer < 2) {
+        // Halted (or ultrasonic, which games use as silence): the output holds
+        triangle.nextClock += (end - triangle.nextClock + period - 1) / period * period;
+        return;
+    }
+
+    while (triangle.nextClock < end) {
+        triangle.sequence = (triangle.sequence + 1) & 31;
+        UpdateOutput(triangle.output, TRIANGLE_TABLE[triangle.sequence], TRIANGLE_SCALE, triangle.nextClock);
+        triangle.nextClock += period;
+    }
+}
+
+void APU::RunNoise(uint64_t end) {
+    int volume = noise.length ? noise.envelope.Volume() : 0;
+    UpdateOutput(noise.output, (noise.shift & 1) ? 0 : volume, NOISE_SCALE, cycle);
+
+    if (noise.nextClock >= end) {
+        return;
+    }
+
+    uint64_t period = NOISE_PERIODS[noise.periodIndex];
+    if (volume == 0) {
+        // Silent: the shift register is left where it is; its phase is not
+        // audible, and at the shortest period it would step 7457 times a frame
+        noise.nextClock += (end - noise.nextClock + period - 1) / period * period;
+        return;
+    }
+
+    int tap = noise.mode ? 6 : 1;
+    while (noise.nextClock < end) {
+        uint16_t feedback = (noise.shift ^ (noise.shift >> tap)) & 1;
+        noise.shift = (noise.shift >> 1) | (feedback << 14);
+        UpdateOutput(noise.output, (noise.shift & 1) ? 0 : volume, NOISE_SCALE, noise.nextClock);
+        noise.nextClock += period;
+    }
+}
+
+void APU::RunDMC(uint64_t end) {
+    UpdateOutput(dmc.output, dmc.level, DMC_SCALE, cycle);
+
+    if (dmc.nextClock >= end) {
+        return;
+    }
+
+    uint64_t period = DMC_PERIODS[dmc.rateIndex];
+    if (dmc.silence && !dmc.bufferFull) {
+        // Idle until a sample is started: only the bit counter moves
+        uint64_t steps = (end - dmc.nextClock + period - 1) / period;
+        dmc.bitsRemaining = (uint8_t)(((dmc.bitsRemaining - 1 - steps % 8) + 8) % 8 + 1);
+        dmc.nextClock += steps * period;
+        return;
+    }
+
+    while (dmc.nextClock < end) {
+        if (!dmc.silence) {
+            if (dmc.shift & 1) {
+                if (dmc.level <= 125) {
+                    dmc.level += 2;
+                }
+            }
+            else if (dmc.level >= 2) {
+                dmc.level -= 2;
+            }
+            UpdateOutput(dmc.output, dmc.level, DMC_SCALE, dmc.nextClock);
+        }
+        dmc.shift >>= 1;
+
+        if (--dmc.bitsRemaining == 0) {
+            dmc.bitsRemaining = 8;
+            if (dmc.bufferFull) {
+                dmc.silence = false;
+                dmc.shift = dmc.sampleBuffer;
+                dmc.bufferFull = false;
+                FetchDMCSample();
+            }
+            else {
+                dmc.silence = true;
+            }
+        }
+        dmc.nextClock += period;
+    }
+}
+
+void APU::FetchDMCSample() {
+    if (dmc.bufferFull || dmc.bytesRemaining == 0) {
+        return;
+    }
+
+    // The CPU stall for the fetch is not modelled
+    dmc.sampleBuffer = memory ? memory->Read(dmc.currentAddr) : 0;
+    dmc.bufferFull = true;
+    dmc.currentAddr = dmc.currentAddr == 0xFFFF ? 0x8000 : dmc.currentAddr + 1;
+
+    if (--dmc.bytesRemaining == 0) {
+        if (dmc.loop) {
+            dmc.currentAddr = dmc.sampleAddr;
+            dmc.bytesRemaining = dmc.sampleLength;
+        }
+        else if (dmc.irqEnabled) {
+            dmc.irqFlag = true;
+            UpdateIRQ();
+        }
+    }
+}
+
+void APU::ClockFrameStep() {
+    uint8_t events = FRAME_STEP_EVENTS[fiveStep][frameStep];
+    if (events & FRAME_QUARTER) {
+        ClockQuarterFrame();
+    }
+    if (events & FRAME_HALF) {
+        ClockHalfFrame();
+    }
+    if ((events & FRAME_IRQ) && !irqInhibit) {
+        frameIrq = true;
+        UpdateIRQ();
+    }
+
+    if (++frameStep == FRAME_STEP_COUNT[fiveStep]) {
+        frameStep = 0;
+        frameStart += FRAME_PERIOD[fiveStep];
+    }
+    UpdateFrameStep();
+}
+
+void APU::ClockQuarterFrame() {
+    pulse[0].envelope.Clock();
+    pulse[1].envelope.Clock();
+    noise.envelope.Clock();
+
+    if (triangle.linearReloadFlag) {
+        triangle.linearCounter = triangle.linearReload;
+    }
+    else if (triangle.linearCounter > 0) {
+        triangle.linearCounter--;
+    }
+    if (!triangle.control) {
+        triangle.linearReloadFlag = false;
+    }
+}
+
+void APU::ClockHalfFrame() {
+    for (Pulse& p : pulse) {
+        if (p.length > 0 && !p.envelope.loop) {
+            p.length--;
+        }
+        p.ClockSweep();
+    }
+    if (triangle.length > 0 && !triangle.control) {
+        triangle.length--;
+    }
+    if (noise.length > 0 && !noise.envelope.loop) {
+        noise.length--;
+    }
+}
+
+void APU::UpdateFrameStep() {
+    nextFrameStep = frameStart + FRAME_STEP_CYCLES[fiveStep][frameStep];
+}
+
+void APU::UpdateIRQ() {
+    irq = frameIrq || dmc.irqFlag;
+}
+
+// Predicts the next cycle at which an IRQ can be raised without a register
+// access: the frame counter's IRQ step, or the DMC's next byte boundary
+// while a non-looping sample with IRQ enabled is playing
+void APU::UpdateNextEvent() {
+    nextEventCycle = std::numeric_limits<uint64_t>::max();
+
+    if (!fiveStep && !irqInhibit && !frameIrq) {
+        nextEventCycle = frameStart + FRAME_STEP_CYCLES[0][3];
+    }
+    if (dmc.irqEnabled && !dmc.loop && dmc.bytesRemaining > 0) {
+        uint64_t byteEnd = dmc.nextClock + (uint64_t)(dmc.bitsRemaining - 1) * DMC_PERIODS[dmc.rateIndex];
+        nextEventCycle = std::min(nextEventCycle, byteEnd + 1);
+    }
+}
+
+uint8_t APU::CPURead(uint16_t addr) {
+    if (addr != 0x4015) {
+        return 0x00;
+    }
+
+    Sync();
+    uint8_t status = 0x00;
+    status |= pulse[0].length > 0 ? 0x01 : 0x00;
+    status |= pulse[1].length > 0 ? 0x02 : 0x00;
+    status |= triangle.length > 0 ? 0x04 : 0x00;
+    status |= noise.length > 0 ? 0x08 : 0x00;
+    status |= dmc.bytesRemaining > 0 ? 0x10 : 0x00;
+    status |= frameIrq ? 0x40 : 0x00;
+    status |= dmc.irqFlag ? 0x80 : 0x00;
+
+    // Reading acknowledges the frame interrupt
+    frameIrq = false;
+    UpdateIRQ();
+    UpdateNextEvent();
+    return status;
+}
+
+void APU::CPUWrite(uint16_t addr, uint8_t data) {
+    Sync();
+
+    switch (addr) {
+    case 0x4000: case 0x4004: {
+        Pulse& p = pulse[(addr >> 2) & 1];
+        p.duty = data >> 6;
+        p.envelope.loop = data & 0x20;
+        p.envelope.constant = data & 0x10;
+        p.envelope.period = data & 0x0F;
+        break;
+    }
+    case 0x4001: case 0x4005: {
+        Pulse& p = pulse[(addr >> 2) & 1];
+        p.sweepEnabled = data & 0x80;
+        p.sweepPeriod = (data >> 4) & 0x07;
+        p.sweepNegate = data & 0x08;
+        p.sweepShift = data & 0x07;
+        p.sweepReload = true;
+        break;
+    }
+    case 0x4002: case 0x4006: {
+        Pulse& p = pulse[(addr >> 2) & 1];
+        p.timer = (p.timer & 0x0700) | data;
+        break;
+    }
+    case 0x4003: case 0x4007: {
+        Pulse& p = pulse[(addr >> 2) & 1];
+        p.timer = (p.timer & 0x00FF) | ((data & 0x07) << 8);
+        if (p.enabled) {
+            p.length = LENGTH_TABLE[data >> 3];
+        }
+        p.sequence = 0;
+        p.envelope.start = true;
+        break;
+    }
+    case 0x4008:
+        triangle.control = data & 0x80;
+        triangle.linearReload = data & 0x7F;
+        break;
+    case 0x400A:
+        triangle.timer = (triangle.timer & 0x0700) | data;
+        break;
+    case 0x400B:
+        triangle.timer = (triangle.timer & 0x00FF) | ((data & 0x07) << 8);
+        if (triangle.enabled) {
+            triangle.length = LENGTH_TABLE[data >> 3];
+        }
+        triangle.linearReloadFlag = true;
+        break;
+    case 0x400C:
+        noise.envelope.loop = data & 0x20;
+        noise.envelope.constant = data & 0x10;
+        noise.envelope.period = data & 0x0F;
+        break;
+    case 0x400E:
+        noise.mode = data & 0x80;
+        noise.periodIndex = data & 0x0F;
+        break;
+    case 0x400F:
+        if (noise.enabled) {
+            noise.length = LENGTH_TABLE[data >> 3];
+        }
+        noise.envelope.start = true;
+        break;
+    case 0x4010:
+        dmc.irqEnabled = data & 0x80;
+        dmc.loop = data & 0x40;
+        dmc.rateIndex = data & 0x0F;
+        if (!dmc.irqEnabled) {
+            dmc.irqFlag = false;
+        }
+        break;
+    case 0x4011:
+        dmc.level = data & 0x7F;
+        break;
+    case 0x4012:
+        dmc.sampleAddr = 0xC000 | (data << 6);
+        break;
+    case 0x4013:
+        dmc.sampleLength = (data << 4) | 1;
+        break;
+    case 0x4015:
+        pulse[0].enabled = data & 0x01;
+        pulse[1].enabled = data & 0x02;
+        triangle.enabled = data & 0x04;
+        noise.enabled = data & 0x08;
+        if (!pulse[0].enabled) pulse[0].length = 0;
+        if (!pulse[1].enabled) pulse[1].length = 0;
+        if (!triangle.enabled) triangle.length = 0;
+        if (!noise.enabled) noise.length = 0;
+
+        if (data & 0x10) {
+            if (dmc.bytesRemaining == 0) {
+                dmc.currentAddr = dmc.sampleAddr;
+                dmc.bytesRemaining = dmc.sampleLength;
+                FetchDMCSample();
+            }
+        }
+        else {
+            dmc.bytesRemaining = 0;
+        }
+        dmc.irqFlag = false;
+        break;
+    case 0x4017:
+        // The sequencer restart delay (3-4 cycles) is not modelled
+        fiveStep = data & 0x80;
+        irqInhibit = data & 0x40;
+        if (irqInhibit) {
+            frameIrq = false;
+        }
+        frameStep = 0;
+        frameStart = cycle;
+        if (fiveStep) {
+            ClockQuarterFrame();
+            ClockHalfFrame();
+        }
+        UpdateFrameStep();
+        break;
+    default:
+        break;
+    }
+
+    UpdateIRQ();
+    UpdateNextEvent();
+}
@@ -0,0 +1,195 @@
+// APU.h
+#pragma once
+#include <cstdint>
+#include "BlipBuffer.h"
+
+class Memory;
+class StateReader;
+class StateWriter;
+
+// 2A03 sound: two pulse channels, triangle, noise and DMC plus the frame
+// counter. Like the PPU it runs behind the CPU and is caught up by Sync()
+// on register accesses, at NextEventCycle() (IRQs) and at the end of each
+// video frame. Channels advance from one timer event to the next instead
+// of cycle by cycle, and only report output changes to a BlipBuffer, so a
+// frame of audio costs a few thousand events rather than ~30k clocks.
+class APU {
+public:
+    APU();
+    void Reset();
+
+    // CPU Interface ($4000-$4013, $4015, $4017)
+    uint8_t CPURead(uint16_t addr);
+    void CPUWrite(uint16_t addr, uint8_t data);
+
+    void ConnectClock(const uint64_t* cpuCycles);
+    void ConnectMemory(Memory* memory); // DMC sample fetches
+    void Sync();
+    uint64_t NextEventCycle() const;
+
+    // Closes the current audio frame (called by NES once per video frame)
+    void EndFrame();
+
+    // Save states: channel, frame counter and IRQ state. Buffered samples
+    // are kept, and output continues from the current level. Call Sync()
+    // first.
+    void SaveState(StateWriter& state) const;
+    void LoadState(StateReader& state);
+
+    // Output sample rate; 0 disables synthesis (channels still run)
+    void SetSampleRate(int rate);
+    int SampleRate() const;
+
+    // Scales the output rate for dynamic rate control (see
+    // AudioRateControl). Call between frames; takes effect immediately
+    // without clearing buffered samples.
+    void SetResampleRatio(double ratio);
+
+    // Suspends synthesis for frames that will be rolled back with
+    // LoadState (run-ahead). Nothing is output while suspended, and
+    // resuming restores the channel levels from the suspend point, so after
+    // the rollback the audio continues as if those frames never ran.
+    void SuspendOutput();
+    void ResumeOutput();
+    int SamplesAvailable() const;
+    int ReadSamples(int16_t* out, int count);
+
+    // Frame counter or DMC interrupt pending; polled by the CPU like the
+    // mapper IRQ line
+    bool irq;
+
+    static const int CPU_CLOCK_RATE = 1789773;
+
+private:
+    struct Envelope {
+        bool start;
+        bool loop;     // Also the length counter halt flag
+        bool constant;
+        uint8_t period; // Also the constant volume
+        uint8_t divider;
+        uint8_t decay;
+
+        void Clock();
+        int Volume() const;
+    };
+
+    struct Pulse {
+        Envelope envelope;
+        uint8_t duty;
+        uint8_t sequence;
+        uint16_t timer;    // 11-bit period register
+        uint8_t length;
+        bool enabled;
+        bool sweepEnabled;
+        bool sweepNegate;
+        bool sweepReload;
+        uint8_t sweepPeriod;
+        uint8_t sweepShift;
+        uint8_t sweepDivider;
+        bool onesComplement; // Pulse 1 negates with ones' complement
+
+        uint64_t nextClock; // CPU cycle of the next sequencer step
+        int output;
+
+        int SweepTarget() const;
+        bool Muted() const;
+        void ClockSweep();
+    };
+
+    struct Triangle {
+        uint8_t sequence;
+        uint16_t timer;
+        uint8_t length;
+        bool enabled;
+        bool control;        // Length halt and linear counter control
+        uint8_t linearReload;
+        uint8_t linearCounter;
+        bool linearReloadFlag;
+
+        uint64_t nextClock;
+        int output;
+    };
+
+    struct Noise {
+        Envelope envelope;
+        bool mode;
+        uint8_t periodIndex;
+        uint16_t shift;
+        uint8_t length;
+        bool enabled;
+
+        uint64_t nextClock;
+        int output;
+    };
+
+    struct DMC {
+        bool irqEnabled;
+        bool loop;
+        uint8_t rateIndex;
+        uint8_t level;       // 7-bit output level
+        uint16_t sampleAddr;
+        uint16_t sampleLength;
+        uint16_t currentAddr;
+        uint16_t bytesRemaining;
+        uint8_t sampleBuffer;
+        bool bufferFull;
+        uint8_t shift;
+        uint8_t bitsRemaining;
+        bool silence;
+        bool irqFlag;
+
+        uint64_t nextClock;
+        int output;
+    };
+
+    Pulse pulse[2];
+    Triangle triangle;
+    Noise noise;
+    DMC dmc;
+
+    // Frame counter
+    bool fiveStep;
+    bool irqInhibit;
+    bool frameIrq;
+    int frameStep;
+    uint64_t frameStart;    // CPU cycle the sequence was last reset or wrapped
+    uint64_t nextFrameStep;
+
+    // Lazy synchronization
+    const uint64_t* cpuClock;
+    Memory* memory;
+    uint64_t cycle;         // Cycle the APU has run up to
+    uint64_t nextEventCycle;
+
+    // Output
+    BlipBuffer blip;
+    int sampleRate;
+    double resampleRatio;
+    bool outputSuspended;
+    int suspendedOutput[5];  // Channel levels when output was suspended
+    uint64_t blipFrameStart; // CPU cycle of BlipBuffer time zero
+
+    void Run(uint64_t target);
+    void RunPulse(Pulse& p, uint64_t end);
+    void RunTriangle(uint64_t end);
+    void RunNoise(uint64_t end);
+    void RunDMC(uint64_t end);
+
+    void ClockFrameStep();
+    void ClockQuarterFrame();
+    void ClockHalfFrame();
+    void UpdateFrameStep();
+
+    static void SaveEnvelope(StateWriter& state, const Envelope& envelope);
+    static void LoadEnvelope(StateReader& state, Envelope& envelope);
+
+    void UpdateOutput(int& output, int level, int scale, uint64_t time);
+    void FetchDMCSample();
+    void UpdateIRQ();
+    void UpdateNextEvent();
+};
+
+// Checked by NES::Clock every CPU cycle
+inline uint64_t APU::NextEventCycle() const {
+    return nextEventCycle;
+}
@@ -0,0 +1,48 @@
+// AudioRateControl.cpp
+#include "AudioRateControl.h"
+#include <algorithm>
+
+// The fill level seen once a frame jitters by a callback period; a short
+// moving average keeps that jitter out of the pitch
+static const double FILL_SMOOTHING = 0.125;
+
+// Integral gain relative to the proportional term, per frame. The
+// proportional term alone settles away from the target by an amount that
+// grows with the clock mismatch; the integral term learns the mismatch.
+// At 1/1024 the loop is close to critically damped for a one-frame target.
+static const double INTEGRAL_RATE = 1.0 / 1024;
+
+AudioRateControl::AudioRateControl(size_t targetFill, double maxDeviation)
+    : targetFill(std::max<size_t>(targetFill, 1)), maxDeviation(maxDeviation) {
+    Reset();
+}
+
+void AudioRateControl::Reset() {
+    integral = 0.0;
+    metrics = Metrics();
+    metrics.ratio = 1.0;
+    metrics.minRatio = 1.0;
+    metrics.maxRatio = 1.0;
+    metrics.averageFill = (double)targetFill;
+    metrics.targetFill = targetFill;
+}
+
+double AudioRateControl::Update(size_t fillBeforeWrite, size_t written) {
+    double fill = fillBeforeWrite + written * 0.5;
+    metrics.averageFill += (fill - metrics.averageFill) * FILL_SMOOTHING;
+
+    // -1 when full at twice the target, +1 when empty
+    double error = 1.0 - metrics.averageFill / targetFill;
+    error = std::clamp(error, -1.0, 1.0);
+
+    integral = std::clamp(integral + maxDeviation * error * INTEGRAL_RATE, -maxDeviation, maxDeviation);
+    metrics.ratio = std::clamp(1.0 + maxDeviation * error + integral, 1.0 - maxDeviation, 1.0 + maxDeviation);
+    metrics.minRatio = std::min(metrics.minRatio, metrics.ratio);
+    metrics.maxRatio = std::max(metrics.maxRatio, metrics.ratio);
+    metrics.updates++;
+    return metrics.ratio;
+}
+
+const AudioRateControl::Metrics& AudioRateControl::GetMetrics() const {
+    return metrics;
+}
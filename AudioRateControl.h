@@ -0,0 +1,42 @@
+// AudioRateControl.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Dynamic rate control: emulation is paced by the video clock, the audio
+// device by its own crystal, so left alone the ring between them slowly
+// fills or drains. Once per frame the producer reports the ring's fill
+// level and gets back a resampling ratio within 1 +- maxDeviation that
+// steers the fill towards the target: below target the APU makes slightly
+// more samples per frame, above it slightly fewer, and a slow integral
+// term learns the steady clock mismatch. The pitch change
+// (0.5% by default) is inaudible, and the target can stay around a frame
+// of audio. Fill levels are averages over a frame: samples arrive in one
+// burst per frame and drain continuously, so the ring is a sawtooth.
+class AudioRateControl {
+public:
+    AudioRateControl(size_t targetFill, double maxDeviation = 0.005);
+
+    // Called by the producer once per frame with the ring's fill level
+    // just before the frame's samples were written and the number written;
+    // returns the ratio to apply to the next frame (APU::SetResampleRatio)
+    double Update(size_t fillBeforeWrite, size_t written);
+
+    void Reset();
+
+    struct Metrics {
+        double ratio;        // Last ratio returned by Update
+        double minRatio;
+        double maxRatio;
+        double averageFill;  // Smoothed fill level, in samples
+        size_t targetFill;
+        uint64_t updates;
+    };
+    const Metrics& GetMetrics() const;
+
+private:
+    size_t targetFill;
+    double maxDeviation;
+    double integral; // Learned clock mismatch
+    Metrics metrics;
+};
@@ -0,0 +1,72 @@
+// AudioRing.cpp
+#include "AudioRing.h"
+#include <algorithm>
+#include <cstring>
+
+AudioRing::AudioRing(size_t capacity)
+    : writePos(0), droppedSamples(0), readPos(0), underruns(0), underrunSamples(0) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    buffer.assign(size, 0);
+    mask = size - 1;
+}
+
+size_t AudioRing::Write(const int16_t* samples, size_t count) {
+    size_t write = writePos.load(std::memory_order_relaxed);
+    size_t read = readPos.load(std::memory_order_acquire);
+    size_t requested = count;
+    count = std::min(count, buffer.size() - (write - read));
+    if (count < requested) {
+        droppedSamples.fetch_add(requested - count, std::memory_order_relaxed);
+    }
+
+    // At most two copies: up to the end of the buffer, then from the start
+    size_t start = write & mask;
+    size_t first = std::min(count, buffer.size() - start);
+    std::memcpy(&buffer[start], samples, first * sizeof(int16_t));
+    std::memcpy(&buffer[0], samples + first, (count - first) * sizeof(int16_t));
+
+    writePos.store(write + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRing::Read(int16_t* samples, size_t count) {
+    size_t read = readPos.load(std::memory_order_relaxed);
+    size_t write = writePos.load(std::memory_order_acquire);
+    size_t requested = count;
+    count = std::min(count, write - read);
+    if (count < requested) {
+        underruns.fetch_add(1, std::memory_order_relaxed);
+        underrunSamples.fetch_add(requested - count, std::memory_order_relaxed);
+    }
+
+    size_t start = read & mask;
+    size_t first = std::min(count, buffer.size() - start);
+    std::memcpy(samples, &buffer[start], first * sizeof(int16_t));
+    std::memcpy(samples + first, &buffer[0], (count - first) * sizeof(int16_t));
+
+    readPos.store(read + count, std::memory_order_release);
+    return count;
+}
+
+size_t AudioRing::Available() const {
+    return writePos.load(std::memory_order_acquire) - readPos.load(std::memory_order_acquire);
+}
+
+size_t AudioRing::Capacity() const {
+    return buffer.size();
+}
+
+uint64_t AudioRing::Underruns() const {
+    return underruns.load(std::memory_order_relaxed);
+}
+
+uint64_t AudioRing::UnderrunSamples() const {
+    return underrunSamples.load(std::memory_order_relaxed);
+}
+
+uint64_t AudioRing::DroppedSamples() const {
+    return droppedSamples.load(std::memory_order_relaxed);
+}
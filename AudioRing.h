@@ -0,0 +1,43 @@
+// AudioRing.h
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Lock-free single-producer/single-consumer ring of 16-bit samples. The
+// emulation thread writes each frame's samples in one bulk Write; the
+// audio callback drains them with Read. Indices increase monotonically
+// and are masked on access, so full and empty need no extra flag.
+class AudioRing {
+public:
+    // capacity is rounded up to a power of two
+    explicit AudioRing(size_t capacity = 8192);
+
+    // Producer side: returns the number of samples written (the rest are
+    // dropped when the ring is full)
+    size_t Write(const int16_t* samples, size_t count);
+
+    // Consumer side: returns the number of samples read. A short read
+    // counts as an underrun.
+    size_t Read(int16_t* samples, size_t count);
+
+    size_t Available() const; // Samples waiting to be read
+    size_t Capacity() const;
+
+    uint64_t Underruns() const;       // Reads that came up short
+    uint64_t UnderrunSamples() const; // Samples missing from those reads
+    uint64_t DroppedSamples() const;  // Samples a full ring refused
+
+private:
+    std::vector<int16_t> buffer;
+    size_t mask;
+
+    // Each index is written by one side only; kept on separate cache
+    // lines so the two threads do not contend
+    alignas(64) std::atomic<size_t> writePos;
+    std::atomic<uint64_t> droppedSamples;
+    alignas(64) std::atomic<size_t> readPos;
+    std::atomic<uint64_t> underruns;
+    std::atomic<uint64_t> underrunSamples;
+};
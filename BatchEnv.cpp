@@ -0,0 +1,186 @@
+// BatchEnv.cpp
+#include "BatchEnv.h"
+#include <algorithm>
+#include "NES.h"
+
+BatchEnv::BatchEnv(const Cartridge& rom, int count, const Config& config)
+    : config(config), envs(count), rewards(count, 0.0f), done(count, 0), actions(nullptr),
+      generation(0), busyWorkers(0), stopping(false), job(JOB_STEP), nextEnv(0) {
+    int bytesPerPixel = config.observation == PPU::OUTPUT_ARGB ? 4 : config.observation == PPU::OUTPUT_INDEXED ? 1 : 0;
+    observationSize = 256 * 240 * bytesPerPixel;
+    observations.assign(count * observationSize, 0);
+
+    for (int i = 0; i < count; i++) {
+        Env& env = envs[i];
+        env.cartridge.reset(new Cartridge(rom));
+        env.nes.reset(new NES(env.cartridge.get()));
+        env.nes->apu.SetSampleRate(0);
+
+        // Render in place into the tensor
+        uint8_t* slot = &observations[i * observationSize];
+        if (config.observation == PPU::OUTPUT_ARGB) {
+            env.nes->ppu.SetFrameBuffer(reinterpret_cast<uint32_t*>(slot));
+        }
+        else if (config.observation == PPU::OUTPUT_INDEXED) {
+            env.nes->ppu.SetIndexBuffer(slot);
+        }
+    }
+
+    // Every core powers on identically, so one state serves them all
+    if (count > 0) {
+        envs[0].nes->Reset();
+        initialState.resize(envs[0].nes->StateSize());
+        envs[0].nes->SaveState(initialState.data(), initialState.size());
+    }
+
+    int threads = config.threads > 0 ? config.threads : (int)std::thread::hardware_concurrency();
+    threads = std::max(1, std::min(threads, count));
+    for (int i = 1; i < threads; i++) {
+        workers.emplace_back(&BatchEnv::Worker, this);
+    }
+
+    Reset();
+}
+
+BatchEnv::~BatchEnv() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int BatchEnv::Count() const {
+    return (int)envs.size();
+}
+
+const uint8_t* BatchEnv::Observations() const {
+    return observations.data();
+}
+
+size_t BatchEnv::ObservationSize() const {
+    return observationSize;
+}
+
+const float* BatchEnv::Rewards() const {
+    return rewards.data();
+}
+
+const uint8_t* BatchEnv::Done() const {
+    return done.data();
+}
+
+NES& BatchEnv::Core(int index) {
+    return *envs[index].nes;
+}
+
+void BatchEnv::Reset() {
+    RunBatch(JOB_RESET);
+}
+
+void BatchEnv::Reset(int index) {
+    ResetEnv(index);
+}
+
+void BatchEnv::Step(const uint8_t* actions) {
+    this->actions = actions;
+    RunBatch(JOB_STEP);
+}
+
+void BatchEnv::RunBatch(Job batchJob) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        job = batchJob;
+        nextEnv.store(0, std::memory_order_relaxed);
+        busyWorkers = (int)workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    RunJobs();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    finished.wait(lock, [this] { return busyWorkers == 0; });
+}
+
+void BatchEnv::Worker() {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this, seen] { return stopping || generation != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+
+        RunJobs();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--busyWorkers == 0) {
+            finished.notify_one();
+        }
+    }
+}
+
+// Claims cores one at a time, so threads that finish early take over the
+// remaining work
+void BatchEnv::RunJobs() {
+    int count = (int)envs.size();
+    for (int i = nextEnv.fetch_add(1, std::memory_order_relaxed); i < count;
+         i = nextEnv.fetch_add(1, std::memory_order_relaxed)) {
+        if (job == JOB_STEP) {
+            StepEnv(i);
+        }
+        else {
+            ResetEnv(i);
+        }
+    }
+}
+
+void BatchEnv::StepEnv(int index) {
+    NES& nes = *envs[index].nes;
+    if (!nes.Running()) {
+        rewards[index] = 0.0f;
+        done[index] = 1;
+        return;
+    }
+
+    float before = ReadReward(index);
+    nes.controller1.SetButtonStates(actions[index]);
+
+    // Skipped frames are emulated without pixel output
+    nes.ppu.SetOutputMode(PPU::OUTPUT_NONE);
+    for (int frame = 1; frame < config.frameSkip; frame++) {
+        nes.RunFrame();
+    }
+    nes.ppu.SetOutputMode(config.observation);
+    nes.RunFrame();
+
+    rewards[index] = ReadReward(index) - before;
+    done[index] = nes.Running() ? 0 : 1;
+}
+
+void BatchEnv::ResetEnv(int index) {
+    NES& nes = *envs[index].nes;
+    nes.LoadState(initialState.data(), initialState.size());
+    nes.controller1.SetButtonStates(0);
+    nes.ppu.SetOutputMode(config.observation);
+    nes.RunFrame();
+
+    rewards[index] = 0.0f;
+    done[index] = nes.Running() ? 0 : 1;
+}
+
+float BatchEnv::ReadReward(int index) const {
+    const Memory& memory = envs[index].nes->memory;
+    float total = 0.0f;
+    for (const RewardTerm& term : config.reward) {
+        total += term.weight * memory.Peek(term.address);
+    }
+    return total;
+}
@@ -0,0 +1,100 @@
+// BatchEnv.h
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Cartridge.h"
+#include "PPU.h"
+
+class NES;
+
+// Many cores running one game in lockstep, for reinforcement learning. All
+// cores share the loaded cartridge's ROM image. Step() applies one action
+// per core, runs every core across a pool of worker threads and returns
+// when all are done; each core renders straight into its slot of one
+// contiguous observation tensor, and rewards are computed from RAM.
+class BatchEnv {
+public:
+    // Reward per step: the sum of weight * (value after - value before)
+    // over the listed RAM/PRG RAM bytes, e.g. a score or position counter
+    struct RewardTerm {
+        uint16_t address;
+        float weight;
+    };
+
+    struct Config {
+        int frameSkip = 4; // Frames per step, all with the same action; only the last is rendered
+        PPU::OutputMode observation = PPU::OUTPUT_INDEXED; // INDEXED: 1 byte per pixel, ARGB: 4
+        int threads = 0;   // Worker threads including the caller; 0 = one per hardware thread
+        std::vector<RewardTerm> reward;
+    };
+
+    // rom should be loaded (Cartridge::Loaded()); if it is not, every core
+    // starts halted and Done() is 1 for all of them
+    BatchEnv(const Cartridge& rom, int count, const Config& config);
+    ~BatchEnv();
+
+    int Count() const;
+
+    // Observations: Count() frames of 256x240 pixels back to back, in the
+    // configured format, ObservationSize() bytes each
+    const uint8_t* Observations() const;
+    size_t ObservationSize() const;
+
+    // Per core, updated by Step()
+    const float* Rewards() const;
+    const uint8_t* Done() const; // 1 once the core's CPU has halted
+
+    // Returns every core (or one) to its power-on state, identical for all
+    // cores and every episode, and renders the first frame
+    void Reset();
+    void Reset(int index);
+
+    // actions: one button mask per core (bit n = button n)
+    void Step(const uint8_t* actions);
+
+    NES& Core(int index);
+
+private:
+    struct Env {
+        std::unique_ptr<Cartridge> cartridge;
+        std::unique_ptr<NES> nes;
+    };
+
+    Config config;
+    std::vector<Env> envs;
+    std::vector<uint8_t> initialState;
+    std::vector<uint8_t> observations;
+    size_t observationSize;
+    std::vector<float> rewards;
+    std::vector<uint8_t> done;
+    const uint8_t* actions;
+
+    // Worker pool. Each batch bumps the generation; every thread, the
+    // caller included, claims cores from nextEnv until none are left.
+    enum Job {
+        JOB_STEP,
+        JOB_RESET
+    };
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    uint64_t generation;
+    int busyWorkers;
+    bool stopping;
+    Job job;
+    std::atomic<int> nextEnv;
+
+    void RunBatch(Job batchJob);
+    void Worker();
+    void RunJobs();
+    void StepEnv(int index);
+    void ResetEnv(int index);
+    float ReadReward(int index) const;
+};
@@ -0,0 +1,150 @@
+// BlipBuffer.cpp
+#include "BlipBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+// Differences of a band-limited step for each sub-sample phase. Tap i of
+// phase p is S(x) - S(x - 1) at x = i - HALF_WIDTH + 1 - p / PHASES, where
+// S is the integral of a Blackman-windowed sinc, scaled so every phase
+// sums to exactly 1 << KERNEL_BITS.
+struct StepKernel {
+    int16_t taps[BlipBuffer::PHASES][BlipBuffer::KERNEL_WIDTH];
+
+    StepKernel() {
+        const int half = BlipBuffer::HALF_WIDTH;
+        const int phases = BlipBuffer::PHASES;
+        const int oversample = 16;
+        const double cutoff = 0.90; // Fraction of Nyquist kept
+        const double pi = 3.14159265358979323846;
+
+        // Step response on a grid of 1 / phases, integrated at a finer step
+        int points = 2 * half * phases + 1;
+        std::vector<double> step(points, 0.0);
+        double sum = 0.0;
+        double prev = 0.0;
+        for (int g = 0; g < points; g++) {
+            for (int k = (g == 0 ? oversample : 1); k <= oversample; k++) {
+                double x = -half + (g - 1 + (double)k / oversample) / phases;
+                double sinc = x == 0.0 ? cutoff : std::sin(pi * cutoff * x) / (pi * x);
+                double window = 0.42 + 0.5 * std::cos(pi * x / half) + 0.08 * std::cos(2 * pi * x / half);
+                double h = sinc * window;
+                sum += (prev + h) * 0.5 / (phases * oversample);
+                prev = h;
+            }
+            step[g] = sum;
+        }
+        for (double& s : step) {
+            s /= sum;
+        }
+
+        auto stepAt = [&](int grid) {
+            grid += half * phases;
+            return grid <= 0 ? 0.0 : grid >= points ? 1.0 : step[grid];
+        };
+
+        for (int p = 0; p < phases; p++) {
+            int total = 0;
+            for (int i = 0; i < BlipBuffer::KERNEL_WIDTH; i++) {
+                int grid = (i - half + 1) * phases - p;
+                double d = stepAt(grid) - stepAt(grid - phases);
+                taps[p][i] = (int16_t)std::lround(d * (1 << BlipBuffer::KERNEL_BITS));
+                total += taps[p][i];
+            }
+            // Put the rounding error on the center tap
+            taps[p][half - 1] += (int16_t)((1 << BlipBuffer::KERNEL_BITS) - total);
+        }
+    }
+};
+
+const StepKernel& Kernel() {
+    static const StepKernel kernel;
+    return kernel;
+}
+
+}
+
+BlipBuffer::BlipBuffer(int capacity)
+    : buffer(capacity + KERNEL_WIDTH, 0), capacity(capacity), factor(0), frameOffset(0), writeEnd(0), integrator(0) {
+    Kernel();
+}
+
+void BlipBuffer::SetRates(double clockRate, double sampleRate) {
+    factor = (uint64_t)std::llround(sampleRate / clockRate * 4294967296.0);
+}
+
+void BlipBuffer::Clear() {
+    std::fill(buffer.begin(), buffer.end(), 0);
+    frameOffset = 0;
+    writeEnd = 0;
+    integrator = 0;
+}
+
+void BlipBuffer::AddDelta(uint32_t clockTime, int delta) {
+    uint64_t pos = frameOffset + clockTime * factor;
+    uint64_t index = pos >> 32;
+    if (index >= (uint64_t)capacity) {
+        return; // Reader fell too far behind; drop rather than overrun
+    }
+
+    const int16_t* taps = Kernel().taps[(pos >> (32 - PHASE_BITS)) & (PHASES - 1)];
+    int32_t* out = &buffer[index];
+    for (int i = 0; i < KERNEL_WIDTH; i++) {
+        out[i] += taps[i] * delta;
+    }
+    writeEnd = std::max(writeEnd, (int)index + KERNEL_WIDTH);
+}
+
+void BlipBuffer::EndFrame(uint32_t clockDuration) {
+    frameOffset += clockDuration * factor;
+
+    // Nobody is reading: keep the newest half of the buffer
+    int available = SamplesAvailable();
+    if (available > capacity / 2) {
+        RemoveSamples(available - capacity / 2);
+    }
+}
+
+int BlipBuffer::SamplesAvailable() const {
+    return (int)std::min<uint64_t>(frameOffset >> 32, capacity);
+}
+
+int BlipBuffer::ReadSamples(int16_t* out, int count) {
+    count = std::min(count, SamplesAvailable());
+    Integrate(out, count);
+    return count;
+}
+
+void BlipBuffer::RemoveSamples(int count) {
+    // Dropped samples still pass through the integrator so the output
+    // level stays continuous
+    Integrate(nullptr, std::min(count, SamplesAvailable()));
+}
+
+void BlipBuffer::Integrate(int16_t* out, int count) {
+    if (count <= 0) {
+        return;
+    }
+
+    int32_t sum = integrator;
+    for (int i = 0; i < count; i++) {
+        int32_t s = sum >> KERNEL_BITS;
+        sum += buffer[i];
+        if (out) {
+            out[i] = (int16_t)std::clamp(s, -32768, 32767);
+        }
+        sum -= s * (1 << (KERNEL_BITS - BASS_SHIFT));
+    }
+    integrator = sum;
+
+    // Shift out the consumed samples. Everything up to writeEnd moves,
+    // including deltas already added for the still-open frame, so reads
+    // may happen mid-frame.
+    int used = std::max(SamplesAvailable() + KERNEL_WIDTH, writeEnd);
+    std::memmove(buffer.data(), buffer.data() + count, (used - count) * sizeof(int32_t));
+    std::fill(buffer.begin() + (used - count), buffer.begin() + used, 0);
+    frameOffset -= (uint64_t)count << 32;
+    writeEnd = std::max(writeEnd - count, 0);
+}
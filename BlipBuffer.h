@@ -0,0 +1,48 @@
+// BlipBuffer.h
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// Band-limited step synthesis. Sound channels report only the moments
+// their output level changes (AddDelta, in source clocks since the start
+// of the frame); each change is drawn as a windowed-sinc step into a
+// difference buffer at the output sample rate, and EndFrame/ReadSamples
+// integrate it into alias-free 16-bit samples. Work is proportional to the
+// number of level changes, not to the source clock rate.
+class BlipBuffer {
+public:
+    explicit BlipBuffer(int capacity = 8192);
+
+    void SetRates(double clockRate, double sampleRate);
+    void Clear();
+
+    // clockTime counts source clocks from the start of the current frame;
+    // delta is in output sample units
+    void AddDelta(uint32_t clockTime, int delta);
+
+    // Closes the frame after clockDuration clocks, making its samples
+    // available. Times passed to AddDelta restart from zero.
+    void EndFrame(uint32_t clockDuration);
+
+    int SamplesAvailable() const;
+    int ReadSamples(int16_t* out, int count);
+    void RemoveSamples(int count);
+
+    static const int PHASE_BITS = 6;
+    static const int PHASES = 1 << PHASE_BITS;
+    static const int HALF_WIDTH = 8;
+    static const int KERNEL_WIDTH = HALF_WIDTH * 2;
+    static const int KERNEL_BITS = 15;
+
+private:
+    static const int BASS_SHIFT = 9; // DC-blocking high-pass, ~14 Hz at 44.1 kHz
+
+    std::vector<int32_t> buffer; // capacity + KERNEL_WIDTH differences
+    int capacity;
+    uint64_t factor;      // Output samples per clock, 32.32 fixed point
+    uint64_t frameOffset; // Start of the open frame, 32.32 fixed point
+    int writeEnd;         // One past the last difference AddDelta touched
+    int32_t integrator;
+
+    void Integrate(int16_t* out, int count); // out may be null to drop
+};
@@ -1,10 +1,10 @@
 // CPU.cpp
 #include "CPU.h"
+#include "SaveState.h"
 #include <cstdio>
 #include <cstring>
 
-CPU::CPU(Memory* memory, PPU* ppu) : mem(memory), ppu(ppu), running(true) {
-    InitializeOpcodeTable();
+CPU::CPU(Memory* memory, PPU* ppu) : running(true), mem(memory), ppu(ppu), trace(nullptr) {
     Reset();
 }
 
@@ -22,6 +22,8 @@ void CPU::Reset() {
     fetched = 0;
 
     cycles = 8;
+    clockCount = 0;
+    instructionCount = 0;
 }
 
 void CPU::ExecuteInstruction() {
@@ -29,23 +31,38 @@ void CPU::ExecuteInstruction() {
 
     if (cycles == 0) {
         opcode = FetchByte();
-        printf("PC: 0x%04X, Opcode: 0x%02X, A: 0x%02X, X: 0x%02X, Y: 0x%02X, SP: 0x%02X, P: 0x%02X\n",
-            PC - 1, opcode, A, X, Y, SP, P);
-
-        if (opcode >= lookup.size() || lookup[opcode].operate == nullptr) {
-            printf("Unimplemented opcode: 0x%02X at PC: 0x%04X\n", opcode, PC - 1);
-            running = false;
-            return;
+        instructionCount++;
+
+#if NES_TRACE
+        if (trace) {
+            TraceRecord record = {};
+            record.cycle = clockCount;
+            record.pc = PC - 1;
+            record.opcode = opcode;
+            record.operand[0] = mem->Peek(PC);
+            record.operand[1] = mem->Peek(PC + 1);
+            record.a = A;
+            record.x = X;
+            record.y = Y;
+            record.sp = SP;
+            record.p = P;
+            trace->Push(record);
         }
+#endif
 
+#if NES_CPU_SWITCH
+        Dispatch();
+#else
         cycles = lookup[opcode].cycles;
 
         uint8_t additional_cycle1 = (this->*lookup[opcode].addrmode)();
         uint8_t additional_cycle2 = (this->*lookup[opcode].operate)();
 
         cycles += (additional_cycle1 & additional_cycle2);
+#endif
     }
 
+    clockCount++;
     cycles--;
 }
 
@@ -54,14 +71,29 @@ void CPU::NMI() {
     Write(0x0100 + SP--, PC & 0xFF);        // Push PC low byte
     SetFlag(BREAK_FLAG, false);
     SetFlag(UNUSED, true);
-    SetFlag(INTERRUPT, true);
     Write(0x0100 + SP--, P | UNUSED);       // Push P with U flag set
+    SetFlag(INTERRUPT, true);               // After the push, so RTI restores I
     uint16_t low = Read(0xFFFA);
     uint16_t high = Read(0xFFFB);
     PC = (high << 8) | low;                 // Set PC to NMI vector
     cycles = 7;
 }
+void CPU::IRQ() {
+    if (GetFlag(INTERRUPT)) return;
+
+    Write(0x0100 + SP--, (PC >> 8) & 0xFF); // Push PC high byte
+    Write(0x0100 + SP--, PC & 0xFF);        // Push PC low byte
+    Write(0x0100 + SP--, (P & ~BREAK_FLAG) | UNUSED); // Push P with B clear
+    SetFlag(INTERRUPT, true);
+    uint16_t low = Read(0xFFFE);
+    uint16_t high = Read(0xFFFF);
+    PC = (high << 8) | low;                 // Set PC to IRQ vector
+    cycles = 7;
+}
 
+void CPU::AttachTrace(TraceWriter* writer) {
+    trace = writer;
+}
 
 uint8_t CPU::FetchByte() {
     uint8_t data = Read(PC);
@@ -86,61 +118,39 @@ bool CPU::GetFlag(uint8_t flag) {
     return (P & flag) != 0;
 }
 
-void CPU::InitializeOpcodeTable() {
-    lookup.resize(256);
-
-    // Fill the opcode table with all instructions
-    // For brevity, only a few examples are shown here. You need to fill in the rest.
-
-    // ADC - Add with Carry
-    lookup[0x69] = { "ADC", &CPU::ADC, &CPU::Immediate, 2 };
-    lookup[0x65] = { "ADC", &CPU::ADC, &CPU::ZeroPage, 3 };
-    lookup[0x75] = { "ADC", &CPU::ADC, &CPU::ZeroPageX, 4 };
-    lookup[0x6D] = { "ADC", &CPU::ADC, &CPU::Absolute, 4 };
-    lookup[0x7D] = { "ADC", &CPU::ADC, &CPU::AbsoluteX, 4 };
-    lookup[0x79] = { "ADC", &CPU::ADC, &CPU::AbsoluteY, 4 };
-    lookup[0x61] = { "ADC", &CPU::ADC, &CPU::IndirectX, 6 };
-    lookup[0x71] = { "ADC", &CPU::ADC, &CPU::IndirectY, 5 };
-
-    // AND - Logical AND
-    lookup[0x29] = { "AND", &CPU::AND, &CPU::Immediate, 2 };
-    lookup[0x25] = { "AND", &CPU::AND, &CPU::ZeroPage, 3 };
-    lookup[0x35] = { "AND", &CPU::AND, &CPU::ZeroPageX, 4 };
-    lookup[0x2D] = { "AND", &CPU::AND, &CPU::Absolute, 4 };
-    lookup[0x3D] = { "AND", &CPU::AND, &CPU::AbsoluteX, 4 };
-    lookup[0x39] = { "AND", &CPU::AND, &CPU::AbsoluteY, 4 };
-    lookup[0x21] = { "AND", &CPU::AND, &CPU::IndirectX, 6 };
-    lookup[0x31] = { "AND", &CPU::AND, &CPU::IndirectY, 5 };
-
-    // ASL - Arithmetic Shift Left
-    lookup[0x0A] = { "ASL", &CPU::ASL, &CPU::Accumulator, 2 };
-    lookup[0x06] = { "ASL", &CPU::ASL, &CPU::ZeroPage, 5 };
-    lookup[0x16] = { "ASL", &CPU::ASL, &CPU::ZeroPageX, 6 };
-    lookup[0x0E] = { "ASL", &CPU::ASL, &CPU::Absolute, 6 };
-    lookup[0x1E] = { "ASL", &CPU::ASL, &CPU::AbsoluteX, 7 };
-
-    // BCC - Branch if Carry Clear
-    lookup[0x90] = { "BCC", &CPU::BCC, &CPU::Relative, 2 };
-
-    // LDA - it does something
-    lookup[0xA9] = { "LDA", &CPU::LDA, &CPU::Immediate, 2 };
-    lookup[0xA5] = { "LDA", &CPU::LDA, &CPU::ZeroPage, 3 };
-    lookup[0xB5] = { "LDA", &CPU::LDA, &CPU::ZeroPageX, 4 };
-    lookup[0xAD] = { "LDA", &CPU::LDA, &CPU::Absolute, 4 };
-    lookup[0xBD] = { "LDA", &CPU::LDA, &CPU::AbsoluteX, 4 };
-    lookup[0xB9] = { "LDA", &CPU::LDA, &CPU::AbsoluteY, 4 };
-    lookup[0xA1] = { "LDA", &CPU::LDA, &CPU::IndirectX, 6 };
-    lookup[0xB1] = { "LDA", &CPU::LDA, &CPU::IndirectY, 5 };
-
-    // ... Continue filling in the rest of the opcodes ...
-
-    // Implement NOP for unimplemented opcodes
-    for (uint16_t i = 0; i < 256; i++) {
-        if (lookup[i].name.empty()) {
-            lookup[i] = { "NOP", &CPU::NOP, &CPU::Implied, 2 };
-        }
+constexpr std::array<CPU::Instruction, 256> CPU::BuildOpcodeTable() {
+    std::array<Instruction, 256> table{};
+
+#define OPCODE(code, name, operate, mode, cyc) table[code] = { name, &CPU::operate, &CPU::Address<mode>, cyc };
+#include "CPUOpcodes.inc"
+#undef OPCODE
+
+    return table;
+}
+
+constexpr std::array<CPU::Instruction, 256> CPU::lookup = CPU::BuildOpcodeTable();
+
+#if NES_CPU_SWITCH
+// Fused interpreter: each case instantiates its addressing mode and
+// operation together, so both calls are resolved and inlined at compile time
+template <CPU::AddrMode M, uint8_t(CPU::* Operate)(void)>
+inline void CPU::Step(uint8_t baseCycles) {
+    cycles = baseCycles;
+
+    uint8_t additional_cycle1 = Address<M>();
+    uint8_t additional_cycle2 = (this->*Operate)();
+
+    cycles += (additional_cycle1 & additional_cycle2);
+}
+
+void CPU::Dispatch() {
+    switch (opcode) {
+#define OPCODE(code, name, operate, mode, cyc) case code: Step<mode, &CPU::operate>(cyc); break;
+#include "CPUOpcodes.inc"
+#undef OPCODE
     }
 }
+#endif
 
 uint8_t CPU::Read(uint16_t address) {
     return mem->Read(address);
@@ -150,18 +160,36 @@ void CPU::Write(uint16_t address, uint8_t data) {
     mem->Write(address, data);
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::Fetch() {
-    if (!(lookup[opcode].addrmode == &CPU::Implied || lookup[opcode].addrmode == &CPU::Accumulator)) {
-        fetched = Read(addr_abs);
+    if constexpr (M == IMP || M == ACC) {
+        fetched = A;
     }
     else {
-        fetched = A;
+        fetched = Read(addr_abs);
     }
     return fetched;
 }
 
 // Addressing Modes Implementations
 
+template <CPU::AddrMode M>
+uint8_t CPU::Address() {
+    if constexpr (M == IMP) return Implied();
+    else if constexpr (M == ACC) return Accumulator();
+    else if constexpr (M == IMM) return Immediate();
+    else if constexpr (M == ZP) return ZeroPage();
+    else if constexpr (M == ZPX) return ZeroPageX();
+    else if constexpr (M == ZPY) return ZeroPageY();
+    else if constexpr (M == REL) return Relative();
+    else if constexpr (M == ABS) return Absolute();
+    else if constexpr (M == ABX) return AbsoluteX();
+    else if constexpr (M == ABY) return AbsoluteY();
+    else if constexpr (M == IND) return Indirect();
+    else if constexpr (M == IZX) return IndirectX();
+    else return IndirectY();
+}
+
 uint8_t CPU::Implied() {
     fetched = A;
     return 0;
@@ -276,37 +304,49 @@ uint8_t CPU::IndirectY() {
 
 // Instruction Implementations
 
+template <CPU::AddrMode M>
 uint8_t CPU::ADC() {
-    Fetch();
+    Fetch<M>();
+    DoADC();
+    return 1;
+}
+
+void CPU::DoADC() {
     uint16_t temp = (uint16_t)A + (uint16_t)fetched + (uint16_t)(GetFlag(CARRY) ? 1 : 0);
     SetFlag(CARRY, temp > 255);
     SetFlag(ZERO, (temp & 0x00FF) == 0);
     SetFlag(OVERFLOW_FLAG, (~((uint16_t)A ^ (uint16_t)fetched) & ((uint16_t)A ^ temp)) & 0x0080);
     SetFlag(NEGATIVE, temp & 0x80);
     A = temp & 0x00FF;
-    return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::AND() {
-    Fetch();
+    Fetch<M>();
+    DoAND();
+    return 1;
+}
+
+void CPU::DoAND() {
     A = A & fetched;
     SetFlag(ZERO, A == 0x00);
     SetFlag(NEGATIVE, A & 0x80);
-    return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::ASL() {
-    Fetch();
+    Fetch<M>();
     uint16_t temp = (uint16_t)fetched << 1;
     SetFlag(CARRY, (temp & 0xFF00) > 0);
     SetFlag(ZERO, (temp & 0x00FF) == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
-    if (lookup[opcode].addrmode == &CPU::Accumulator) {
+    if constexpr (M == ACC) {
         A = temp & 0x00FF;
     }
     else {
         Write(addr_abs, temp & 0x00FF);
     }
+    fetched = temp & 0x00FF; // For SLO
     return 0;
 }
 
@@ -349,8 +389,9 @@ uint8_t CPU::BEQ() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::BIT() {
-    Fetch();
+    Fetch<M>();
     uint8_t temp = A & fetched;
     SetFlag(ZERO, (temp & 0x00FF) == 0x00);
     SetFlag(NEGATIVE, fetched & (1 << 7));
@@ -457,17 +498,23 @@ uint8_t CPU::CLV() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::CMP() {
-    Fetch();
+    Fetch<M>();
+    DoCMP();
+    return 1;
+}
+
+void CPU::DoCMP() {
     uint16_t temp = (uint16_t)A - (uint16_t)fetched;
     SetFlag(CARRY, A >= fetched);
     SetFlag(ZERO, (temp & 0x00FF) == 0x0000);
     SetFlag(NEGATIVE, temp & 0x0080);
-    return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::CPX() {
-    Fetch();
+    Fetch<M>();
     uint16_t temp = (uint16_t)X - (uint16_t)fetched;
     SetFlag(CARRY, X >= fetched);
     SetFlag(ZERO, (temp & 0x00FF) == 0x0000);
@@ -475,8 +522,9 @@ uint8_t CPU::CPX() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::CPY() {
-    Fetch();
+    Fetch<M>();
     uint16_t temp = (uint16_t)Y - (uint16_t)fetched;
     SetFlag(CARRY, Y >= fetched);
     SetFlag(ZERO, (temp & 0x00FF) == 0x0000);
@@ -484,10 +532,12 @@ uint8_t CPU::CPY() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::DEC() {
-    Fetch();
+    Fetch<M>();
     uint8_t temp = fetched - 1;
     Write(addr_abs, temp);
+    fetched = temp; // For DCP
     SetFlag(ZERO, temp == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
     return 0;
@@ -507,18 +557,25 @@ uint8_t CPU::DEY() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::EOR() {
-    Fetch();
+    Fetch<M>();
+    DoEOR();
+    return 1;
+}
+
+void CPU::DoEOR() {
     A = A ^ fetched;
     SetFlag(ZERO, A == 0x00);
     SetFlag(NEGATIVE, A & 0x80);
-    return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::INC() {
-    Fetch();
+    Fetch<M>();
     uint8_t temp = fetched + 1;
     Write(addr_abs, temp);
+    fetched = temp; // For ISB
     SetFlag(ZERO, temp == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
     return 0;
@@ -553,56 +610,74 @@ uint8_t CPU::JSR() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::LDA() {
-    Fetch();
+    Fetch<M>();
     A = fetched;
     SetFlag(ZERO, A == 0x00);
     SetFlag(NEGATIVE, A & 0x80);
     return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::LDX() {
-    Fetch();
+    Fetch<M>();
     X = fetched;
     SetFlag(ZERO, X == 0x00);
     SetFlag(NEGATIVE, X & 0x80);
     return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::LDY() {
-    Fetch();
+    Fetch<M>();
     Y = fetched;
     SetFlag(ZERO, Y == 0x00);
     SetFlag(NEGATIVE, Y & 0x80);
     return 1;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::LSR() {
-    Fetch();
+    Fetch<M>();
     SetFlag(CARRY, fetched & 0x01);
     uint8_t temp = fetched >> 1;
     SetFlag(ZERO, temp == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
-    if (lookup[opcode].addrmode == &CPU::Accumulator) {
+    if constexpr (M == ACC) {
         A = temp;
     }
     else {
         Write(addr_abs, temp);
     }
+    fetched = temp; // For SRE
     return 0;
 }
 
-uint8_t CPU::NOP() {
-    // NOP does nothing
+uint8_t CPU::KIL() {
+    // Jams the CPU; only a reset recovers it
+    printf("CPU halted by opcode: 0x%02X at PC: 0x%04X\n", opcode, PC - 1);
+    running = false;
     return 0;
 }
 
+uint8_t CPU::NOP() {
+    // NOP does nothing, but the unofficial absolute,X forms still pay the
+    // page-crossing cycle
+    return 1;
+}
+
+template <CPU::AddrMode M>
 uint8_t CPU::ORA() {
-    Fetch();
+    Fetch<M>();
+    DoORA();
+    return 1;
+}
+
+void CPU::DoORA() {
     A = A | fetched;
     SetFlag(ZERO, A == 0x00);
     SetFlag(NEGATIVE, A & 0x80);
-    return 1;
 }
 
 uint8_t CPU::PHA() {
@@ -630,33 +705,37 @@ uint8_t CPU::PLP() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::ROL() {
-    Fetch();
+    Fetch<M>();
     uint16_t temp = (uint16_t)(fetched << 1) | (GetFlag(CARRY) ? 1 : 0);
     SetFlag(CARRY, temp & 0xFF00);
     SetFlag(ZERO, (temp & 0x00FF) == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
-    if (lookup[opcode].addrmode == &CPU::Accumulator) {
+    if constexpr (M == ACC) {
         A = temp & 0x00FF;
     }
     else {
         Write(addr_abs, temp & 0x00FF);
     }
+    fetched = temp & 0x00FF; // For RLA
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::ROR() {
-    Fetch();
+    Fetch<M>();
     uint16_t temp = (uint16_t)(GetFlag(CARRY) ? 0x80 : 0x00) | (fetched >> 1);
     SetFlag(CARRY, fetched & 0x01);
     SetFlag(ZERO, (temp & 0x00FF) == 0x00);
     SetFlag(NEGATIVE, temp & 0x80);
-    if (lookup[opcode].addrmode == &CPU::Accumulator) {
+    if constexpr (M == ACC) {
         A = temp & 0x00FF;
     }
     else {
         Write(addr_abs, temp & 0x00FF);
     }
+    fetched = temp & 0x00FF; // For RRA
     return 0;
 }
 
@@ -684,8 +763,14 @@ uint8_t CPU::RTS() {
     return 0;
 }
 
+template <CPU::AddrMode M>
 uint8_t CPU::SBC() {
-    Fetch();
+    Fetch<M>();
+    DoSBC();
+    return 1;
+}
+
+void CPU::DoSBC() {
     uint16_t value = ((uint16_t)fetched) ^ 0x00FF;
     uint16_t temp = (uint16_t)A + value + (uint16_t)(GetFlag(CARRY) ? 1 : 0);
     SetFlag(CARRY, temp & 0xFF00);
@@ -693,7 +778,6 @@ uint8_t CPU::SBC() {
     SetFlag(OVERFLOW_FLAG, (temp ^ (uint16_t)A) & (temp ^ value) & 0x0080);
     SetFlag(NEGATIVE, temp & 0x80);
     A = temp & 0x00FF;
-    return 1;
 }
 
 uint8_t CPU::SEC() {
@@ -765,3 +849,149 @@ uint8_t CPU::TYA() {
     SetFlag(NEGATIVE, A & 0x80);
     return 0;
 }
+
+// Unofficial Opcode Implementations
+
+template <CPU::AddrMode M>
+uint8_t CPU::ALR() {
+    AND<M>();
+    SetFlag(CARRY, A & 0x01);
+    A >>= 1;
+    SetFlag(ZERO, A == 0x00);
+    SetFlag(NEGATIVE, A & 0x80);
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::ANC() {
+    AND<M>();
+    SetFlag(CARRY, A & 0x80);
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::ARR() {
+    AND<M>();
+    A = (GetFlag(CARRY) ? 0x80 : 0x00) | (A >> 1);
+    SetFlag(ZERO, A == 0x00);
+    SetFlag(NEGATIVE, A & 0x80);
+    SetFlag(CARRY, A & 0x40);
+    SetFlag(OVERFLOW_FLAG, ((A >> 6) ^ (A >> 5)) & 0x01);
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::AXS() {
+    Fetch<M>();
+    uint8_t ax = A & X;
+    SetFlag(CARRY, ax >= fetched);
+    X = ax - fetched;
+    SetFlag(ZERO, X == 0x00);
+    SetFlag(NEGATIVE, X & 0x80);
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::DCP() {
+    // The ALU half works on the value just written, without reading the
+    // address again (a second read of a register would have side effects)
+    DEC<M>();
+    DoCMP();
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::ISB() {
+    INC<M>();
+    DoSBC();
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::LAS() {
+    Fetch<M>();
+    A = X = SP = fetched & SP;
+    SetFlag(ZERO, A == 0x00);
+    SetFlag(NEGATIVE, A & 0x80);
+    return 1;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::LAX() {
+    Fetch<M>();
+    A = X = fetched;
+    SetFlag(ZERO, A == 0x00);
+    SetFlag(NEGATIVE, A & 0x80);
+    return 1;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::RLA() {
+    ROL<M>();
+    DoAND();
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::RRA() {
+    ROR<M>();
+    DoADC();
+    return 0;
+}
+
+uint8_t CPU::SAX() {
+    Write(addr_abs, A & X);
+    return 0;
+}
+
+uint8_t CPU::SHx() {
+    // The unstable stores are not emulated, but they keep store timing:
+    // no page-crossing cycle, unlike the absolute,X NOPs
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::SLO() {
+    ASL<M>();
+    DoORA();
+    return 0;
+}
+
+template <CPU::AddrMode M>
+uint8_t CPU::SRE() {
+    LSR<M>();
+    DoEOR();
+    return 0;
+}
+
+void CPU::SaveState(StateWriter& state) const {
+    state.Write(A);
+    state.Write(X);
+    state.Write(Y);
+    state.Write(SP);
+    state.Write(PC);
+    state.Write(P);
+    state.Write(cycles);
+    state.Write(clockCount);
+    state.Write(running);
+    state.Write(opcode);
+    state.Write(fetched);
+    state.Write(addr_abs);
+    state.Write(addr_rel);
+}
+
+void CPU::LoadState(StateReader& state) {
+    state.Read(A);
+    state.Read(X);
+    state.Read(Y);
+    state.Read(SP);
+    state.Read(PC);
+    state.Read(P);
+    state.Read(cycles);
+    state.Read(clockCount);
+    state.Read(running);
+    state.Read(opcode);
+    state.Read(fetched);
+    state.Read(addr_abs);
+    state.Read(addr_rel);
+}
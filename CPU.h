@@ -1,10 +1,18 @@
 // CPU.h
 #pragma once
+#include <array>
 #include <cstdint>
-#include <vector>
-#include <string>
 #include "Memory.h"
 #include "PPU.h"
+#include "Trace.h"
+
+class StateReader;
+class StateWriter;
+
+// Select the fused switch interpreter (1) or the opcode table dispatch (0)
+#ifndef NES_CPU_SWITCH
+#define NES_CPU_SWITCH 1
+#endif
 
 class CPU {
 public:
@@ -12,6 +20,15 @@ public:
     void Reset();
     void ExecuteInstruction();
     void NMI();
+    void IRQ(); // Ignored while the interrupt disable flag is set
+
+    // Send executed instructions to a trace writer (nullptr to stop).
+    // Only has an effect in builds with NES_TRACE enabled.
+    void AttachTrace(TraceWriter* writer);
+
+    // Save states (see SaveState.h)
+    void SaveState(StateWriter& state) const;
+    void LoadState(StateReader& state);
 
     // Registers
     uint8_t  A;  // Accumulator
@@ -22,12 +39,15 @@ public:
     uint8_t  P;  // Status Register
 
     uint8_t cycles;
+    uint64_t clockCount; // Total CPU cycles since reset
+    uint64_t instructionCount; // Instructions started since reset; for benchmarks, not saved
 
     bool running; // Flag to indicate if the CPU should continue executing
 
 private:
     Memory* mem;
     PPU* ppu;
+    TraceWriter* trace;
 
     // Helper methods
     uint8_t FetchByte();
@@ -47,23 +67,27 @@ private:
         NEGATIVE = (1 << 7)
     };
 
-    // Opcode table
+    // Addressing modes, used to instantiate handlers at compile time
+    enum AddrMode { IMP, ACC, IMM, ZP, ZPX, ZPY, REL, ABS, ABX, ABY, IND, IZX, IZY };
+
+    // Opcode table, built at compile time from CPUOpcodes.inc
     struct Instruction {
-        std::string name;
+        const char* name;
         uint8_t(CPU::* operate)(void);
         uint8_t(CPU::* addrmode)(void);
         uint8_t cycles;
     };
-    std::vector<Instruction> lookup;
+    static const std::array<Instruction, 256> lookup;
+    static constexpr std::array<Instruction, 256> BuildOpcodeTable();
 
     // Opcode implementations
-    uint8_t ADC();
-    uint8_t AND();
-    uint8_t ASL();
+    template <AddrMode M> uint8_t ADC();
+    template <AddrMode M> uint8_t AND();
+    template <AddrMode M> uint8_t ASL();
     uint8_t BCC();
     uint8_t BCS();
     uint8_t BEQ();
-    uint8_t BIT();
+    template <AddrMode M> uint8_t BIT();
     uint8_t BMI();
     uint8_t BNE();
     uint8_t BPL();
@@ -74,33 +98,34 @@ private:
     uint8_t CLD();
     uint8_t CLI();
     uint8_t CLV();
-    uint8_t CMP();
-    uint8_t CPX();
-    uint8_t CPY();
-    uint8_t DEC();
+    template <AddrMode M> uint8_t CMP();
+    template <AddrMode M> uint8_t CPX();
+    template <AddrMode M> uint8_t CPY();
+    template <AddrMode M> uint8_t DEC();
     uint8_t DEX();
     uint8_t DEY();
-    uint8_t EOR();
-    uint8_t INC();
+    template <AddrMode M> uint8_t EOR();
+    template <AddrMode M> uint8_t INC();
     uint8_t INX();
     uint8_t INY();
     uint8_t JMP();
     uint8_t JSR();
-    uint8_t LDA();
-    uint8_t LDX();
-    uint8_t LDY();
-    uint8_t LSR();
+    uint8_t KIL();
+    template <AddrMode M> uint8_t LDA();
+    template <AddrMode M> uint8_t LDX();
+    template <AddrMode M> uint8_t LDY();
+    template <AddrMode M> uint8_t LSR();
     uint8_t NOP();
-    uint8_t ORA();
+    template <AddrMode M> uint8_t ORA();
     uint8_t PHA();
     uint8_t PHP();
     uint8_t PLA();
     uint8_t PLP();
-    uint8_t ROL();
-    uint8_t ROR();
+    template <AddrMode M> uint8_t ROL();
+    template <AddrMode M> uint8_t ROR();
     uint8_t RTI();
     uint8_t RTS();
-    uint8_t SBC();
+    template <AddrMode M> uint8_t SBC();
     uint8_t SEC();
     uint8_t SED();
     uint8_t SEI();
@@ -114,7 +139,32 @@ private:
     uint8_t TXS();
     uint8_t TYA();
 
+    // Unofficial opcodes
+    template <AddrMode M> uint8_t ALR();
+    template <AddrMode M> uint8_t ANC();
+    template <AddrMode M> uint8_t ARR();
+    template <AddrMode M> uint8_t AXS();
+    template <AddrMode M> uint8_t DCP();
+    template <AddrMode M> uint8_t ISB();
+    template <AddrMode M> uint8_t LAS();
+    template <AddrMode M> uint8_t LAX();
+    template <AddrMode M> uint8_t RLA();
+    template <AddrMode M> uint8_t RRA();
+    uint8_t SAX();
+    uint8_t SHx(); // AHX, SHX, SHY, TAS
+    template <AddrMode M> uint8_t SLO();
+    template <AddrMode M> uint8_t SRE();
+
+    // ALU halves of ADC, AND, CMP, EOR, ORA and SBC, on fetched
+    void DoADC();
+    void DoAND();
+    void DoCMP();
+    void DoEOR();
+    void DoORA();
+    void DoSBC();
+
     // Addressing modes
+    template <AddrMode M> uint8_t Address();
     uint8_t Implied();
     uint8_t Accumulator();
     uint8_t Immediate();
@@ -135,8 +185,12 @@ private:
     uint16_t addr_abs;
     uint16_t addr_rel;
 
-    void InitializeOpcodeTable();
     uint8_t Read(uint16_t address);
     void Write(uint16_t address, uint8_t data);
-    uint8_t Fetch();
+    template <AddrMode M> uint8_t Fetch();
+
+#if NES_CPU_SWITCH
+    template <AddrMode M, uint8_t(CPU::* Operate)(void)> void Step(uint8_t baseCycles);
+    void Dispatch();
+#endif
 };
@@ -1,65 +1,85 @@
 // Cartridge.cpp
 #include "Cartridge.h"
-#include <fstream>
+#include "Mapper.h"
+#include "RomImage.h"
+#include "Simd.h"
+#include <cstring>
 #include <iostream>
 
-Cartridge::Cartridge(const std::string& filename) : filename(filename), mirror(HORIZONTAL) {}
+static const char* MIRROR_NAMES[] = { "Horizontal", "Vertical", "Four-screen", "Single-screen low", "Single-screen high" };
 
-bool Cartridge::Load() {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file.is_open()) {
-        std::cout << "Could not open ROM file: " << filename << std::endl;
-        return false;
+Cartridge::Cartridge(const std::string& filename) : romHash(0), mapperID(0), mirror(HORIZONTAL), filename(filename) {}
+
+Cartridge::Cartridge(const Cartridge& rom)
+    : PRG_ROM(rom.PRG_ROM), CHR_ROM(rom.CHR_ROM), CHR_Decoded(rom.CHR_Decoded), PRG_RAM(rom.PRG_RAM),
+      romHash(rom.romHash), mapperID(rom.mapperID), mirror(rom.mirror), filename(rom.filename), image(rom.image) {
+    if (image) {
+        mapper.reset(Mapper::Create(this));
     }
+}
+
+Cartridge::~Cartridge() {}
+
+bool Cartridge::Loaded() const {
+    return mapper != nullptr;
+}
+
+Mapper* Cartridge::GetMapper() {
+    return mapper.get();
+}
 
-    uint8_t header[16];
-    file.read(reinterpret_cast<char*>(header), 16);
+void Cartridge::DecodeCHRRow(uint8_t lsb, uint8_t msb, uint8_t* pixels) {
+#if NES_SIMD_BMI2
+    // Deposit each plane's bits into bit 0/1 of eight bytes. pdep fills from
+    // the low byte up, so swap the bytes to put the leftmost pixel first.
+    uint64_t row = _pdep_u64(lsb, 0x0101010101010101ULL) | _pdep_u64(msb, 0x0202020202020202ULL);
+    row = __builtin_bswap64(row);
+    std::memcpy(pixels, &row, 8);
+#else
+    for (int i = 0; i < 8; i++) {
+        pixels[i] = (((msb >> (7 - i)) & 0x01) << 1) | ((lsb >> (7 - i)) & 0x01);
+    }
+#endif
+}
 
-    // Verify NES file format
-    if (header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A) {
-        std::cout << "Invalid NES ROM file." << std::endl;
+bool Cartridge::Load() {
+    // Shared with every other cartridge loaded from the same contents
+    std::shared_ptr<const RomImage> rom = RomImage::Load(filename);
+    if (!rom) {
         return false;
     }
 
-    uint8_t prgSize = header[4];
-    uint8_t chrSize = header[5];
+    const uint8_t* header = rom->Header();
     mapperID = ((header[6] >> 4) & 0x0F) | (header[7] & 0xF0);
 
     // Set mirroring type
-    if (header[6] & 0x01) {
+    if (header[6] & 0x08) {
+        mirror = FOUR_SCREEN;
+    }
+    else if (header[6] & 0x01) {
         mirror = VERTICAL;
     }
     else {
         mirror = HORIZONTAL;
     }
 
-    // Skip trainer if present
-    if (header[6] & 0x04) {
-        file.seekg(512, std::ios::cur);
-    }
+    // CHR size 0 means the board has 8KB of CHR RAM, which lives in the PPU
+    image = rom;
+    PRG_ROM = { rom->PRG(), rom->PRGSize() };
+    CHR_ROM = { rom->CHR(), rom->CHRSize() };
+    CHR_Decoded = { rom->CHRDecoded(), rom->CHRSize() * 4 };
+    romHash = rom->Hash();
 
-    // Load PRG ROM
-    PRG_ROM.resize(prgSize * 16384);
-    file.read(reinterpret_cast<char*>(PRG_ROM.data()), PRG_ROM.size());
-
-    // Load CHR ROM
-    if (chrSize == 0) {
-        // Some games use CHR RAM instead of ROM
-        CHR_ROM.resize(8192); // 8KB of CHR RAM
-    }
-    else {
-        CHR_ROM.resize(chrSize * 8192);
-        file.read(reinterpret_cast<char*>(CHR_ROM.data()), CHR_ROM.size());
-    }
+    PRG_RAM.assign(8192, 0);
 
-    file.close();
     std::cout << "Loaded ROM: " << filename << std::endl;
     std::cout << "Mapper ID: " << (int)mapperID << std::endl;
     std::cout << "PRG ROM Size: " << PRG_ROM.size() << " bytes" << std::endl;
     std::cout << "CHR ROM Size: " << CHR_ROM.size() << " bytes" << std::endl;
-    std::cout << "Mirroring Type: " << (mirror == VERTICAL ? "Vertical" : "Horizontal") << std::endl;
+    std::cout << "Mirroring Type: " << MIRROR_NAMES[mirror] << std::endl;
 
-    if (mapperID != 0) {
+    mapper.reset(Mapper::Create(this));
+    if (!mapper) {
         std::cout << "Unsupported Mapper ID: " << (int)mapperID << std::endl;
         return false;
     }
@@ -1,26 +1,65 @@
 // Cartridge.h
 #pragma once
+#include <cstddef>
 #include <cstdint>
+#include <memory>
 #include <vector>
 #include <string>
 
+class Mapper;
+class RomImage;
+
 class Cartridge {
 public:
     enum Mirror {
         HORIZONTAL,
         VERTICAL,
         FOUR_SCREEN,
-        SINGLE_SCREEN
+        SINGLE_SCREEN_LOW,
+        SINGLE_SCREEN_HIGH,
+        SINGLE_SCREEN = SINGLE_SCREEN_LOW
     };
 
     Cartridge(const std::string& filename);
+
+    // Another cartridge for the same loaded ROM. The ROM image is shared
+    // read-only; PRG RAM and mirroring are copied, and the copy gets its
+    // own mapper in its power-on state. Lets many cores run one game with
+    // a single copy of PRG/CHR.
+    explicit Cartridge(const Cartridge& rom);
+    ~Cartridge();
     bool Load();
 
-    std::vector<uint8_t> PRG_ROM;
-    std::vector<uint8_t> CHR_ROM;
+    // True once Load() has succeeded, or for a copy of such a cartridge
+    bool Loaded() const;
+
+    Mapper* GetMapper();
+
+    // Expands one pattern table row (its two bit planes) into eight bytes,
+    // one 0-3 pixel value per byte, leftmost pixel first
+    static void DecodeCHRRow(uint8_t lsb, uint8_t msb, uint8_t* pixels);
+
+    // A read-only range of the ROM image, used like the vector it stands in
+    // for. Every cartridge with the same ROM points into one RomImage.
+    struct ROMData {
+        const uint8_t* bytes = nullptr;
+        size_t length = 0;
+
+        const uint8_t* data() const { return bytes; }
+        size_t size() const { return length; }
+        bool empty() const { return length == 0; }
+    };
+
+    ROMData PRG_ROM;
+    ROMData CHR_ROM; // Empty when the board uses CHR RAM
+    ROMData CHR_Decoded; // CHR_ROM as decoded rows, 64 bytes per tile
+    std::vector<uint8_t> PRG_RAM; // 8KB at $6000-$7FFF
+    uint64_t romHash; // FNV-1a of PRG ROM then CHR ROM; identifies the game
     uint8_t mapperID;
     Mirror mirror;
 
 private:
     std::string filename;
-};
\ No newline at end of file
+    std::shared_ptr<const RomImage> image;
+    std::unique_ptr<Mapper> mapper;
+};
@@ -1,5 +1,6 @@
 // Controller.cpp
 #include "Controller.h"
+#include "SaveState.h"
 
 void Controller::Write(uint8_t data) {
     strobe = data & 1;
@@ -24,3 +25,19 @@ void Controller::SetButtonState(uint8_t button, bool pressed) {
     else
         buttonStates &= ~(1 << button);
 }
+
+void Controller::SetButtonStates(uint8_t buttons) {
+    buttonStates = buttons;
+}
+
+void Controller::SaveState(StateWriter& state) const {
+    state.Write(buttonStates);
+    state.Write(shiftRegister);
+    state.Write(strobe);
+}
+
+void Controller::LoadState(StateReader& state) {
+    state.Read(buttonStates);
+    state.Read(shiftRegister);
+    state.Read(strobe);
+}
@@ -2,12 +2,20 @@
 #pragma once
 #include <cstdint>
 
+class StateReader;
+class StateWriter;
+
 class Controller {
 public:
     void Write(uint8_t data);
     uint8_t Read();
 
     void SetButtonState(uint8_t button, bool pressed);
+    void SetButtonStates(uint8_t buttons); // Bit n = button n
+
+    // Save states (see SaveState.h)
+    void SaveState(StateWriter& state) const;
+    void LoadState(StateReader& state);
 
 private:
     uint8_t buttonStates = 0;
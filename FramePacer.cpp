@@ -0,0 +1,46 @@
+// FramePacer.cpp
+#include "FramePacer.h"
+#include <thread>
+
+// Sleeps are only trusted up to this margin; the rest is spent yielding.
+static const std::chrono::microseconds SPIN_MARGIN(1000);
+
+// Falling behind by more than this many frames drops the backlog.
+static const int MAX_LAG_FRAMES = 4;
+
+FramePacer::FramePacer(double framesPerSecond)
+    : period(std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond))),
+      resyncs(0) {
+    Reset();
+}
+
+void FramePacer::Reset() {
+    nextDeadline = Clock::now() + period;
+}
+
+void FramePacer::WaitForNextFrame() {
+    Clock::time_point now = Clock::now();
+
+    if (now < nextDeadline) {
+        if (nextDeadline - now > SPIN_MARGIN) {
+            std::this_thread::sleep_until(nextDeadline - SPIN_MARGIN);
+        }
+        while (Clock::now() < nextDeadline) {
+            std::this_thread::yield();
+        }
+        nextDeadline += period;
+    }
+    else if (now - nextDeadline > period * MAX_LAG_FRAMES) {
+        // Too far behind (debugger, window drag): restart the schedule
+        nextDeadline = now + period;
+        resyncs++;
+    }
+    else {
+        // Slightly late: run the next frame immediately to catch up
+        nextDeadline += period;
+    }
+}
+
+uint64_t FramePacer::Resyncs() const {
+    return resyncs;
+}
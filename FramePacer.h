@@ -0,0 +1,31 @@
+// FramePacer.h
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Paces a frame-granular loop against a high-resolution clock. Deadlines
+// are absolute (start + n * period), so sleep overshoot on one frame is
+// paid back on the next instead of accumulating as drift.
+class FramePacer {
+public:
+    // NTSC NES: 1789773 Hz / 29780.5 CPU cycles per frame
+    static constexpr double NTSC_FRAME_RATE = 60.0988;
+
+    FramePacer(double framesPerSecond = NTSC_FRAME_RATE);
+
+    void Reset();
+
+    // Block until the current frame's deadline, then advance it.
+    void WaitForNextFrame();
+
+    // Number of times the loop fell too far behind and the schedule was
+    // resynchronised instead of trying to catch up.
+    uint64_t Resyncs() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    Clock::duration period;
+    Clock::time_point nextDeadline;
+    uint64_t resyncs;
+};
@@ -0,0 +1,114 @@
+// Mapper.cpp
+#include "Mapper.h"
+#include "Memory.h"
+#include "PPU.h"
+#include "SaveState.h"
+#include "Mapper000.h"
+#include "Mapper001.h"
+#include "Mapper002.h"
+#include "Mapper003.h"
+#include "Mapper004.h"
+#include "Mapper007.h"
+
+static const int PRG_BANK_SIZE = 8192;
+static const int CHR_BANK_SIZE = 1024;
+
+Mapper::Mapper(Cartridge* cart) : irq(false), cartridge(cart), memory(nullptr), ppu(nullptr) {}
+
+Mapper* Mapper::Create(Cartridge* cart) {
+    switch (cart->mapperID) {
+    case 0: return new Mapper000(cart);
+    case 1: return new Mapper001(cart);
+    case 2: return new Mapper002(cart);
+    case 3: return new Mapper003(cart);
+    case 4: return new Mapper004(cart);
+    case 7: return new Mapper007(cart);
+    default: return nullptr;
+    }
+}
+
+void Mapper::Connect(Memory* memory, PPU* ppu) {
+    this->memory = memory;
+    this->ppu = ppu;
+    memory->ConnectMapper(this);
+
+    // PRG RAM at $6000-$7FFF
+    memory->MapReadPages(0x60, 32, cartridge->PRG_RAM.data());
+    memory->MapWritePages(0x60, 32, cartridge->PRG_RAM.data());
+
+    irq = false;
+    Reset();
+}
+
+void Mapper::SaveState(StateWriter& state) const {
+    state.Write(irq);
+    state.Write((uint8_t)cartridge->mirror);
+}
+
+void Mapper::LoadState(StateReader& state) {
+    uint8_t mirror;
+    state.Read(irq);
+    state.ReadRange(mirror, (uint8_t)Cartridge::HORIZONTAL, (uint8_t)Cartridge::SINGLE_SCREEN_HIGH);
+    SetMirroring((Cartridge::Mirror)mirror);
+}
+
+int Mapper::PRGBanks8K() const {
+    return (int)(cartridge->PRG_ROM.size() / PRG_BANK_SIZE);
+}
+
+int Mapper::CHRBanks1K() const {
+    if (cartridge->CHR_ROM.empty()) {
+        return 8; // 8KB CHR RAM
+    }
+    return (int)(cartridge->CHR_ROM.size() / CHR_BANK_SIZE);
+}
+
+void Mapper::SetPRGBank8K(int slot, int bank) {
+    int count = PRGBanks8K();
+    bank %= count;
+    if (bank < 0) bank += count;
+    memory->MapReadPages(0x80 + slot * 0x20, 0x20, cartridge->PRG_ROM.data() + (size_t)bank * PRG_BANK_SIZE);
+}
+
+void Mapper::SetPRGBank16K(int slot, int bank) {
+    SetPRGBank8K(slot * 2, bank * 2);
+    SetPRGBank8K(slot * 2 + 1, bank * 2 + 1);
+}
+
+void Mapper::SetPRGBank32K(int bank) {
+    SetPRGBank16K(0, bank * 2);
+    SetPRGBank16K(1, bank * 2 + 1);
+}
+
+void Mapper::SetCHRBank1K(int slot, int bank) {
+    int count = CHRBanks1K();
+    bank %= count;
+    if (bank < 0) bank += count;
+    if (cartridge->CHR_ROM.empty()) {
+        ppu->MapCHRRam(slot, 1, (uint32_t)bank * CHR_BANK_SIZE);
+    }
+    else {
+        ppu->MapCHRRom(slot, 1, cartridge->CHR_ROM.data() + (size_t)bank * CHR_BANK_SIZE);
+    }
+}
+
+void Mapper::SetCHRBank2K(int slot, int bank) {
+    SetCHRBank1K(slot, bank * 2);
+    SetCHRBank1K(slot + 1, bank * 2 + 1);
+}
+
+void Mapper::SetCHRBank4K(int slot, int bank) {
+    for (int i = 0; i < 4; i++) {
+        SetCHRBank1K(slot * 4 + i, bank * 4 + i);
+    }
+}
+
+void Mapper::SetCHRBank8K(int bank) {
+    SetCHRBank4K(0, bank * 2);
+    SetCHRBank4K(1, bank * 2 + 1);
+}
+
+void Mapper::SetMirroring(Cartridge::Mirror mirror) {
+    cartridge->mirror = mirror;
+    ppu->SetMirroring(mirror);
+}
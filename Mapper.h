@@ -0,0 +1,62 @@
+// Mapper.h
+#pragma once
+#include <cstdint>
+#include "Cartridge.h"
+
+class Memory;
+class PPU;
+class StateReader;
+class StateWriter;
+
+// Cartridge board logic. A mapper never sits on the access path: on every
+// bank switch it rewrites the CPU page table in Memory and the CHR page
+// table in PPU, so reads stay a single indexed load. Only register writes
+// ($4020-$FFFF on pages without RAM) reach the mapper.
+class Mapper {
+public:
+    Mapper(Cartridge* cart);
+    virtual ~Mapper() {}
+
+    // Creates the mapper for cart->mapperID, or nullptr if unsupported
+    static Mapper* Create(Cartridge* cart);
+
+    // Attach to a bus and apply the power-on bank layout
+    void Connect(Memory* memory, PPU* ppu);
+
+    virtual void Reset() = 0;
+    virtual void CPUWrite(uint16_t address, uint8_t data) = 0;
+
+    // Clocked once per rendered scanline, only for mappers that registered
+    // with PPU::SetScanlineCounter (MMC3)
+    virtual void Scanline() {}
+
+    // Save states: registers, IRQ line and mirroring. LoadState re-applies
+    // the bank layout to the CPU and PPU page tables.
+    virtual void SaveState(StateWriter& state) const;
+    virtual void LoadState(StateReader& state);
+
+    // IRQ line, polled by the CPU at instruction boundaries
+    bool irq;
+
+protected:
+    Cartridge* cartridge;
+    Memory* memory;
+    PPU* ppu;
+
+    int PRGBanks8K() const;
+    int CHRBanks1K() const;
+
+    // slot: 8KB window index from $8000 (0-3)
+    void SetPRGBank8K(int slot, int bank);
+    // slot: 16KB window index from $8000 (0-1)
+    void SetPRGBank16K(int slot, int bank);
+    void SetPRGBank32K(int bank);
+
+    // slot: 1KB window index from $0000 in PPU space (0-7)
+    void SetCHRBank1K(int slot, int bank);
+    void SetCHRBank2K(int slot, int bank);
+    void SetCHRBank4K(int slot, int bank);
+    void SetCHRBank8K(int bank);
+
+    void SetMirroring(Cartridge::Mirror mirror);
+};
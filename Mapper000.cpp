@@ -0,0 +1,15 @@
+// Mapper000.cpp
+#include "Mapper000.h"
+
+Mapper000::Mapper000(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper000::Reset() {
+    // 16KB images are mirrored into $C000-$FFFF
+    SetPRGBank16K(0, 0);
+    SetPRGBank16K(1, PRGBanks8K() > 2 ? 1 : 0);
+    SetCHRBank8K(0);
+}
+
+void Mapper000::CPUWrite(uint16_t /*address*/, uint8_t /*data*/) {
+    // No registers
+}
@@ -0,0 +1,11 @@
+// Mapper000.h
+#pragma once
+#include "Mapper.h"
+
+// NROM: fixed 16/32KB PRG, fixed 8KB CHR
+class Mapper000 : public Mapper {
+public:
+    Mapper000(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+};
@@ -0,0 +1,99 @@
+// Mapper001.cpp
+#include "Mapper001.h"
+#include "SaveState.h"
+
+Mapper001::Mapper001(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper001::Reset() {
+    shiftRegister = 0x10;
+    control = 0x0C; // PRG mode 3: last bank fixed at $C000
+    chrBank0 = 0;
+    chrBank1 = 0;
+    prgBank = 0;
+    UpdateBanks();
+}
+
+void Mapper001::CPUWrite(uint16_t address, uint8_t data) {
+    if (address < 0x8000) return;
+
+    if (data & 0x80) {
+        // Reset the shift register and lock PRG mode 3
+        shiftRegister = 0x10;
+        control |= 0x0C;
+        UpdateBanks();
+        return;
+    }
+
+    // A 1 reaching bit 0 marks the fifth write
+    bool complete = shiftRegister & 0x01;
+    shiftRegister = (shiftRegister >> 1) | ((data & 0x01) << 4);
+    if (!complete) return;
+
+    switch ((address >> 13) & 0x03) {
+    case 0: control = shiftRegister; break;   // $8000-$9FFF
+    case 1: chrBank0 = shiftRegister; break;  // $A000-$BFFF
+    case 2: chrBank1 = shiftRegister; break;  // $C000-$DFFF
+    case 3: prgBank = shiftRegister; break;   // $E000-$FFFF
+    }
+    shiftRegister = 0x10;
+    UpdateBanks();
+}
+
+void Mapper001::UpdateBanks() {
+    switch (control & 0x03) {
+    case 0: SetMirroring(Cartridge::SINGLE_SCREEN_LOW); break;
+    case 1: SetMirroring(Cartridge::SINGLE_SCREEN_HIGH); break;
+    case 2: SetMirroring(Cartridge::VERTICAL); break;
+    case 3: SetMirroring(Cartridge::HORIZONTAL); break;
+    }
+
+    // SUROM: CHR bank bit 4 selects the 256KB half of a 512KB PRG image
+    int outer = (PRGBanks8K() > 32) ? (chrBank0 & 0x10) : 0;
+    int bank = outer | (prgBank & 0x0F);
+    int last = outer | 0x0F;
+    if (PRGBanks8K() <= 32) {
+        last = PRGBanks8K() / 2 - 1;
+    }
+
+    switch ((control >> 2) & 0x03) {
+    case 0:
+    case 1:
+        SetPRGBank32K(bank >> 1);
+        break;
+    case 2:
+        SetPRGBank16K(0, outer);
+        SetPRGBank16K(1, bank);
+        break;
+    case 3:
+        SetPRGBank16K(0, bank);
+        SetPRGBank16K(1, last);
+        break;
+    }
+
+    if (control & 0x10) {
+        SetCHRBank4K(0, chrBank0);
+        SetCHRBank4K(1, chrBank1);
+    }
+    else {
+        SetCHRBank8K(chrBank0 >> 1);
+    }
+}
+
+void Mapper001::SaveState(StateWriter& state) const {
+    Mapper::SaveState(state);
+    state.Write(shiftRegister);
+    state.Write(control);
+    state.Write(chrBank0);
+    state.Write(chrBank1);
+    state.Write(prgBank);
+}
+
+void Mapper001::LoadState(StateReader& state) {
+    Mapper::LoadState(state);
+    state.Read(shiftRegister);
+    state.Read(control);
+    state.Read(chrBank0);
+    state.Read(chrBank1);
+    state.Read(prgBank);
+    UpdateBanks();
+}
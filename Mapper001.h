@@ -0,0 +1,22 @@
+// Mapper001.h
+#pragma once
+#include "Mapper.h"
+
+// MMC1 (SxROM): serial-loaded registers, 16/32KB PRG and 4/8KB CHR banking
+class Mapper001 : public Mapper {
+public:
+    Mapper001(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+    void SaveState(StateWriter& state) const override;
+    void LoadState(StateReader& state) override;
+
+private:
+    uint8_t shiftRegister;
+    uint8_t control;
+    uint8_t chrBank0;
+    uint8_t chrBank1;
+    uint8_t prgBank;
+
+    void UpdateBanks();
+};
@@ -0,0 +1,34 @@
+// Mapper002.cpp
+#include "Mapper002.h"
+#include "SaveState.h"
+
+Mapper002::Mapper002(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper002::Reset() {
+    prgBank = 0;
+    SetPRGBank16K(1, PRGBanks8K() / 2 - 1);
+    SetCHRBank8K(0);
+    UpdateBanks();
+}
+
+void Mapper002::CPUWrite(uint16_t address, uint8_t data) {
+    if (address >= 0x8000) {
+        prgBank = data & 0x0F;
+        UpdateBanks();
+    }
+}
+
+void Mapper002::UpdateBanks() {
+    SetPRGBank16K(0, prgBank);
+}
+
+void Mapper002::SaveState(StateWriter& state) const {
+    Mapper::SaveState(state);
+    state.Write(prgBank);
+}
+
+void Mapper002::LoadState(StateReader& state) {
+    Mapper::LoadState(state);
+    state.Read(prgBank);
+    UpdateBanks();
+}
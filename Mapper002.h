@@ -0,0 +1,18 @@
+// Mapper002.h
+#pragma once
+#include "Mapper.h"
+
+// UxROM: switchable 16KB PRG at $8000, last bank fixed at $C000
+class Mapper002 : public Mapper {
+public:
+    Mapper002(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+    void SaveState(StateWriter& state) const override;
+    void LoadState(StateReader& state) override;
+
+private:
+    uint8_t prgBank;
+
+    void UpdateBanks();
+};
@@ -0,0 +1,34 @@
+// Mapper003.cpp
+#include "Mapper003.h"
+#include "SaveState.h"
+
+Mapper003::Mapper003(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper003::Reset() {
+    SetPRGBank16K(0, 0);
+    SetPRGBank16K(1, PRGBanks8K() > 2 ? 1 : 0);
+    chrBank = 0;
+    UpdateBanks();
+}
+
+void Mapper003::CPUWrite(uint16_t address, uint8_t data) {
+    if (address >= 0x8000) {
+        chrBank = data & 0x03;
+        UpdateBanks();
+    }
+}
+
+void Mapper003::UpdateBanks() {
+    SetCHRBank8K(chrBank);
+}
+
+void Mapper003::SaveState(StateWriter& state) const {
+    Mapper::SaveState(state);
+    state.Write(chrBank);
+}
+
+void Mapper003::LoadState(StateReader& state) {
+    Mapper::LoadState(state);
+    state.Read(chrBank);
+    UpdateBanks();
+}
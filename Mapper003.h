@@ -0,0 +1,18 @@
+// Mapper003.h
+#pragma once
+#include "Mapper.h"
+
+// CNROM: fixed PRG, switchable 8KB CHR
+class Mapper003 : public Mapper {
+public:
+    Mapper003(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+    void SaveState(StateWriter& state) const override;
+    void LoadState(StateReader& state) override;
+
+private:
+    uint8_t chrBank;
+
+    void UpdateBanks();
+};
@@ -0,0 +1,125 @@
+// Mapper004.cpp
+#include "Mapper004.h"
+#include "PPU.h"
+#include "SaveState.h"
+#include <cstring>
+
+Mapper004::Mapper004(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper004::Reset() {
+    bankSelect = 0;
+    std::memset(bankRegisters, 0, sizeof(bankRegisters));
+    bankRegisters[7] = 1;
+    irqLatch = 0;
+    irqCounter = 0;
+    irqReload = false;
+    irqEnabled = false;
+    irq = false;
+
+    ppu->SetScanlineCounter(this);
+    UpdateBanks();
+}
+
+void Mapper004::CPUWrite(uint16_t address, uint8_t data) {
+    if (address < 0x8000) return;
+
+    bool even = (address & 0x01) == 0;
+
+    switch (address & 0xE000) {
+    case 0x8000:
+        if (even) {
+            bankSelect = data;
+        }
+        else {
+            bankRegisters[bankSelect & 0x07] = data;
+        }
+        UpdateBanks();
+        break;
+    case 0xA000:
+        if (even && cartridge->mirror != Cartridge::FOUR_SCREEN) {
+            SetMirroring((data & 0x01) ? Cartridge::HORIZONTAL : Cartridge::VERTICAL);
+        }
+        // Odd: PRG RAM protect, not emulated
+        break;
+    case 0xC000:
+        if (even) {
+            irqLatch = data;
+        }
+        else {
+            irqCounter = 0;
+            irqReload = true;
+        }
+        break;
+    case 0xE000:
+        if (even) {
+            irqEnabled = false;
+            irq = false; // Acknowledge
+        }
+        else {
+            irqEnabled = true;
+        }
+        break;
+    }
+}
+
+void Mapper004::Scanline() {
+    if (irqCounter == 0 || irqReload) {
+        irqCounter = irqLatch;
+        irqReload = false;
+    }
+    else {
+        irqCounter--;
+    }
+
+    if (irqCounter == 0 && irqEnabled) {
+        irq = true;
+    }
+}
+
+void Mapper004::SaveState(StateWriter& state) const {
+    Mapper::SaveState(state);
+    state.Write(bankSelect);
+    state.WriteBytes(bankRegisters, sizeof(bankRegisters));
+    state.Write(irqLatch);
+    state.Write(irqCounter);
+    state.Write(irqReload);
+    state.Write(irqEnabled);
+}
+
+void Mapper004::LoadState(StateReader& state) {
+    Mapper::LoadState(state);
+    state.Read(bankSelect);
+    state.ReadBytes(bankRegisters, sizeof(bankRegisters));
+    state.Read(irqLatch);
+    state.Read(irqCounter);
+    state.Read(irqReload);
+    state.Read(irqEnabled);
+    UpdateBanks();
+}
+
+void Mapper004::UpdateBanks() {
+    // PRG: R6 and the second-to-last bank swap places in mode 1
+    int secondLast = PRGBanks8K() - 2;
+    if (bankSelect & 0x40) {
+        SetPRGBank8K(0, secondLast);
+        SetPRGBank8K(2, bankRegisters[6] & 0x3F);
+    }
+    else {
+        SetPRGBank8K(0, bankRegisters[6] & 0x3F);
+        SetPRGBank8K(2, secondLast);
+    }
+    SetPRGBank8K(1, bankRegisters[7] & 0x3F);
+    SetPRGBank8K(3, PRGBanks8K() - 1);
+
+    // CHR: two 2KB banks (R0, R1) and four 1KB banks (R2-R5); A12 inversion
+    // swaps the halves
+    int twoK = (bankSelect & 0x80) ? 4 : 0;
+    int oneK = (bankSelect & 0x80) ? 0 : 4;
+    SetCHRBank1K(twoK + 0, bankRegisters[0] & 0xFE);
+    SetCHRBank1K(twoK + 1, bankRegisters[0] | 0x01);
+    SetCHRBank1K(twoK + 2, bankRegisters[1] & 0xFE);
+    SetCHRBank1K(twoK + 3, bankRegisters[1] | 0x01);
+    for (int i = 0; i < 4; i++) {
+        SetCHRBank1K(oneK + i, bankRegisters[2 + i]);
+    }
+}
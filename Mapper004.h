@@ -0,0 +1,24 @@
+// Mapper004.h
+#pragma once
+#include "Mapper.h"
+
+// MMC3 (TxROM): 8KB PRG and 1/2KB CHR banking with a scanline IRQ counter
+class Mapper004 : public Mapper {
+public:
+    Mapper004(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+    void Scanline() override;
+    void SaveState(StateWriter& state) const override;
+    void LoadState(StateReader& state) override;
+
+private:
+    uint8_t bankSelect;
+    uint8_t bankRegisters[8];
+    uint8_t irqLatch;
+    uint8_t irqCounter;
+    bool irqReload;
+    bool irqEnabled;
+
+    void UpdateBanks();
+};
@@ -0,0 +1,34 @@
+// Mapper007.cpp
+#include "Mapper007.h"
+#include "SaveState.h"
+
+Mapper007::Mapper007(Cartridge* cart) : Mapper(cart) {}
+
+void Mapper007::Reset() {
+    SetCHRBank8K(0);
+    bankRegister = 0;
+    UpdateBanks();
+}
+
+void Mapper007::CPUWrite(uint16_t address, uint8_t data) {
+    if (address >= 0x8000) {
+        bankRegister = data;
+        UpdateBanks();
+    }
+}
+
+void Mapper007::UpdateBanks() {
+    SetPRGBank32K(bankRegister & 0x07);
+    SetMirroring((bankRegister & 0x10) ? Cartridge::SINGLE_SCREEN_HIGH : Cartridge::SINGLE_SCREEN_LOW);
+}
+
+void Mapper007::SaveState(StateWriter& state) const {
+    Mapper::SaveState(state);
+    state.Write(bankRegister);
+}
+
+void Mapper007::LoadState(StateReader& state) {
+    Mapper::LoadState(state);
+    state.Read(bankRegister);
+    UpdateBanks();
+}
@@ -0,0 +1,18 @@
+// Mapper007.h
+#pragma once
+#include "Mapper.h"
+
+// AxROM: switchable 32KB PRG, single-screen mirroring select
+class Mapper007 : public Mapper {
+public:
+    Mapper007(Cartridge* cart);
+    void Reset() override;
+    void CPUWrite(uint16_t address, uint8_t data) override;
+    void SaveState(StateWriter& state) const override;
+    void LoadState(StateReader& state) override;
+
+private:
+    uint8_t bankRegister; // PRG bank in bits 0-2, name table in bit 4
+
+    void UpdateBanks();
+};
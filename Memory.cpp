@@ -1,47 +1,98 @@
 // Memory.cpp
 #include "Memory.h"
-#include <cstring>
+#include "APU.h"
+#include "Mapper.h"
+#include "SaveState.h"
 
-Memory::Memory(Cartridge* cart) : cartridge(cart), ppu(nullptr), controller(nullptr) {
-    std::memset(RAM, 0, sizeof(RAM));
+Memory::Memory(Cartridge* cart)
+    : RAM(PAGE_SIZE, 8), cartridge(cart), ppu(nullptr), apu(nullptr), controller(nullptr), mapper(nullptr) {
+    BuildPageTables();
+}
+
+void Memory::BuildPageTables() {
+    UnmapPages(0x00, 256);
+
+    for (int page = 0; page < 8; page++) {
+        MapRAMPage(page);
+    }
+
+    // PRG RAM and ROM pages are mapped by the cartridge's mapper
+}
+
+// Internal RAM mirrored every 2KB. A page shared with a fork is mapped
+// read-only, so the first write goes through WriteIO and takes a copy.
+void Memory::MapRAMPage(int page) {
+    uint8_t* data = RAM.Shared(page) ? nullptr : RAM.Writable(page);
+    for (int mirror = 0; mirror < 4; mirror++) {
+        MapReadPages(mirror * 8 + page, 1, RAM.Page(page));
+        MapWritePages(mirror * 8 + page, 1, data);
+    }
+}
+
+void Memory::MapReadPages(uint8_t firstPage, int count, const uint8_t* data) {
+    for (int i = 0; i < count && firstPage + i < 256; i++) {
+        readPages[firstPage + i] = data ? data + i * PAGE_SIZE : nullptr;
+    }
+}
+
+void Memory::MapWritePages(uint8_t firstPage, int count, uint8_t* data) {
+    for (int i = 0; i < count && firstPage + i < 256; i++) {
+        writePages[firstPage + i] = data ? data + i * PAGE_SIZE : nullptr;
+    }
+}
+
+void Memory::UnmapPages(uint8_t firstPage, int count) {
+    MapReadPages(firstPage, count, nullptr);
+    MapWritePages(firstPage, count, nullptr);
 }
 
 void Memory::ConnectPPU(PPU* ppu) {
     this->ppu = ppu;
 }
 
+void Memory::ConnectAPU(APU* apu) {
+    this->apu = apu;
+}
+
 void Memory::ConnectController(Controller* controller) {
     this->controller = controller;
 }
 
-uint8_t Memory::Read(uint16_t address) {
-    if (address < 0x2000) {
-        // Internal RAM mirrored every 2KB
-        return RAM[address % 0x0800];
-    }
-    else if (address >= 0x2000 && address < 0x4000) {
+void Memory::ConnectMapper(Mapper* mapper) {
+    this->mapper = mapper;
+}
+
+uint8_t Memory::ReadIO(uint16_t address) {
+    if (address >= 0x2000 && address < 0x4000) {
         // PPU registers mirrored every 8 bytes
         return ppu->CPURead(0x2000 + (address % 8));
     }
+    else if (address == 0x4015) {
+        // APU status
+        return apu->CPURead(address);
+    }
     else if (address == 0x4016) {
         // Controller port 1
         return controller->Read();
     }
-    else if (address >= 0x8000) {
-        // PRG ROM
-        size_t index = (address - 0x8000) % cartridge->PRG_ROM.size();
-        return cartridge->PRG_ROM[index];
-    }
     else {
         // Other memory regions
         return 0x00;
     }
 }
 
-void Memory::Write(uint16_t address, uint8_t data) {
+uint8_t Memory::Peek(uint16_t address) const {
+    // Only directly mapped pages; I/O registers and unmapped regions read 0
+    const uint8_t* page = readPages[address >> 8];
+    return page ? page[address & 0xFF] : 0x00;
+}
+
+void Memory::WriteIO(uint16_t address, uint8_t data) {
     if (address < 0x2000) {
-        // Internal RAM mirrored every 2KB
-        RAM[address % 0x0800] = data;
+        // Internal RAM page still shared with a fork
+        int page = (address >> 8) & 0x07;
+        RAM.Writable(page)[address & 0xFF] = data;
+        MapRAMPage(page);
     }
     else if (address >= 0x2000 && address < 0x4000) {
         // PPU registers mirrored every 8 bytes
@@ -49,6 +100,7 @@ void Memory::Write(uint16_t address, uint8_t data) {
     }
     else if (address == 0x4014) {
         // OAMDMA (DMA transfer to OAM)
+        ppu->Sync();
         uint16_t dmaAddress = data << 8;
         for (int i = 0; i < 256; i++) {
             ppu->OAM[ppu->regOAMAddr++] = Read(dmaAddress + i);
@@ -60,10 +112,44 @@ void Memory::Write(uint16_t address, uint8_t data) {
         // Controller port 1
         controller->Write(data);
     }
-    else if (address >= 0x8000) {
-        // PRG ROM is read-only; ignore writes
+    else if (address < 0x4018) {
+        // APU channels ($4000-$4013), status ($4015) and frame counter ($4017)
+        apu->CPUWrite(address, data);
+    }
+    else if (address >= 0x4020) {
+        // Cartridge space without RAM: mapper registers (ROM is read-only)
+        if (mapper) {
+            mapper->CPUWrite(address, data);
+        }
     }
     else {
         // Other memory regions
     }
 }
+
+void Memory::SaveState(StateWriter& state) const {
+    if (state.Forking()) {
+        return;
+    }
+    for (int page = 0; page < 8; page++) {
+        state.WriteBytes(RAM.Page(page), PAGE_SIZE);
+    }
+}
+
+void Memory::LoadState(StateReader& state) {
+    if (state.Forking()) {
+        return;
+    }
+    for (int page = 0; page < 8; page++) {
+        state.ReadBytes(RAM.Writable(page), PAGE_SIZE);
+        MapRAMPage(page);
+    }
+}
+
+void Memory::Fork(Memory& child) {
+    RAM.Fork(child.RAM);
+    for (int page = 0; page < 8; page++) {
+        MapRAMPage(page);
+        child.MapRAMPage(page);
+    }
+}
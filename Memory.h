@@ -4,6 +4,12 @@
 #include "Cartridge.h"
 #include "PPU.h"
 #include "Controller.h"
+#include "SharedPages.h"
+
+class APU;
+class Mapper;
+class StateReader;
+class StateWriter;
 
 class Memory {
 public:
@@ -11,12 +17,63 @@ public:
     uint8_t Read(uint16_t address);
     void Write(uint16_t address, uint8_t data);
 
+    // Read without side effects (no PPU/controller register access).
+    // Used by tracing and debugging tools.
+    uint8_t Peek(uint16_t address) const;
+
+    // Save states: internal RAM only; the page tables belong to the mapper
+    void SaveState(StateWriter& state) const;
+    void LoadState(StateReader& state);
+
+    // Shares internal RAM with child copy-on-write (NES::Fork)
+    void Fork(Memory& child);
+
     void ConnectPPU(PPU* ppu);
+    void ConnectAPU(APU* apu);
     void ConnectController(Controller* controller);
+    void ConnectMapper(Mapper* mapper);
+
+    // Page table: one entry per 256-byte CPU page. A non-null entry is a
+    // direct pointer to the page's bytes; null pages go through the I/O
+    // handlers. Mappers call these when they bank-switch.
+    static const int PAGE_SIZE = 256;
+    void MapReadPages(uint8_t firstPage, int count, const uint8_t* data);
+    void MapWritePages(uint8_t firstPage, int count, uint8_t* data);
+    void UnmapPages(uint8_t firstPage, int count);
 
 private:
-    uint8_t RAM[2048]; // 2KB internal RAM
+    SharedPages RAM; // 2KB internal RAM in eight pages
     Cartridge* cartridge;
     PPU* ppu;
+    APU* apu;
     Controller* controller;
+    Mapper* mapper;
+
+    const uint8_t* readPages[256];
+    uint8_t* writePages[256];
+
+    void BuildPageTables();
+    void MapRAMPage(int page);
+
+    // Fallbacks for pages without a direct mapping (I/O registers and
+    // mapper register writes)
+    uint8_t ReadIO(uint16_t address);
+    void WriteIO(uint16_t address, uint8_t data);
 };
+
+inline uint8_t Memory::Read(uint16_t address) {
+    const uint8_t* page = readPages[address >> 8];
+    if (page) {
+        return page[address & 0xFF];
+    }
+    return ReadIO(address);
+}
+
+inline void Memory::Write(uint16_t address, uint8_t data) {
+    uint8_t* page = writePages[address >> 8];
+    if (page) {
+        page[address & 0xFF] = data;
+        return;
+    }
+    WriteIO(address, data);
+}
@@ -0,0 +1,247 @@
+// NES.cpp
+#include "NES.h"
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+NES::NES(Cartridge* cart)
+    : cartridge(cart), ppu(cart), memory(cart), cpu(&memory, &ppu),
+      mapper(cart->GetMapper()), frameCount(0), cycleCount(0), stateSize(0) {
+    ppu.ConnectClock(&cycleCount);
+    apu.ConnectClock(&cycleCount);
+    apu.ConnectMemory(&memory);
+    memory.ConnectPPU(&ppu);
+    memory.ConnectAPU(&apu);
+    memory.ConnectController(&controller1);
+
+    // A cartridge whose Load() failed or never ran has no mapper and so no
+    // program; the machine exists but stays halted
+    if (!mapper) {
+        cpu.running = false;
+        return;
+    }
+    mapper->Connect(&memory, &ppu);
+
+    // The CPU constructor ran before PRG ROM was mapped
+    cpu.Reset();
+}
+
+void NES::Reset() {
+    if (!mapper) {
+        return;
+    }
+    mapper->Reset();
+    cpu.Reset();
+    ppu.Reset();
+    apu.Reset();
+    frameCount = 0;
+    cycleCount = 0;
+}
+
+bool NES::Clock() {
+    // Mapper and APU IRQs are level-triggered and taken between instructions
+    if (cpu.cycles == 0 && ((mapper && mapper->irq) || apu.irq)) {
+        cpu.IRQ();
+    }
+
+    // CPU::ExecuteInstruction only fetches a new opcode once the previous
+    // instruction's cycles have elapsed, so it is called every CPU cycle.
+    cpu.ExecuteInstruction();
+    cycleCount++;
+
+    // The PPU and APU run behind the CPU and are caught up when the CPU
+    // touches them or once they reach a point the CPU can observe (NMI, a
+    // mapper scanline tick, an APU IRQ or the end of the frame)
+    if (cycleCount * 3 < ppu.NextEventDot() && cycleCount < apu.NextEventCycle()) {
+        return false;
+    }
+    ppu.Sync();
+    apu.Sync();
+
+    if (ppu.nmi) {
+        ppu.nmi = false;
+        cpu.NMI();
+    }
+
+    bool frameDone = ppu.FrameCount() != frameCount;
+    if (frameDone) {
+        frameCount = ppu.FrameCount();
+        apu.EndFrame();
+    }
+    return frameDone;
+}
+
+void NES::RunCycles(uint32_t n) {
+    for (uint32_t i = 0; i < n && cpu.running; ++i) {
+        Clock();
+    }
+    ppu.Sync();
+    apu.Sync();
+}
+
+void NES::RunFrame() {
+    while (cpu.running) {
+        if (Clock()) {
+            return;
+        }
+    }
+    ppu.Sync();
+    apu.Sync();
+}
+
+bool NES::Running() const {
+    return cpu.running;
+}
+
+uint64_t NES::FrameCount() const {
+    return frameCount;
+}
+
+uint64_t NES::CycleCount() const {
+    return cycleCount;
+}
+
+void NES::SaveComponents(StateWriter& state) const {
+    if (mapper) {
+        mapper->SaveState(state);
+    }
+    state.Write(frameCount);
+    state.Write(cycleCount);
+    cpu.SaveState(state);
+    memory.SaveState(state);
+    state.WriteBytes(cartridge->PRG_RAM.data(), cartridge->PRG_RAM.size());
+    ppu.SaveState(state);
+    apu.SaveState(state);
+    controller1.SaveState(state);
+}
+
+void NES::LoadComponents(StateReader& state) {
+    // First: re-applying banks and mirroring catches up the PPU's current
+    // line, which must happen before the PPU state is replaced
+    if (mapper) {
+        mapper->LoadState(state);
+    }
+    state.Read(frameCount);
+    state.Read(cycleCount);
+    cpu.LoadState(state);
+    memory.LoadState(state);
+    state.ReadBytes(cartridge->PRG_RAM.data(), cartridge->PRG_RAM.size());
+    ppu.LoadState(state);
+    apu.LoadState(state);
+    controller1.LoadState(state);
+}
+
+size_t NES::StateSize() {
+    if (stateSize == 0) {
+        StateWriter measure(nullptr, 0);
+        SaveComponents(measure);
+        stateSize = sizeof(SaveStateHeader) + measure.Size();
+    }
+    return stateSize;
+}
+
+size_t NES::SaveState(uint8_t* buffer, size_t size) {
+    size_t total = StateSize();
+    if (size < total) {
+        return 0;
+    }
+
+    // The PPU and APU lag the CPU; bring them up to the same cycle
+    ppu.Sync();
+    apu.Sync();
+
+    SaveStateHeader header = {};
+    std::memcpy(header.magic, "NESSTATE", 8);
+    header.version = SAVE_STATE_VERSION;
+    header.size = (uint32_t)total;
+    header.romHash = cartridge->romHash;
+    std::memcpy(buffer, &header, sizeof(header));
+
+    StateWriter state(buffer + sizeof(header), total - sizeof(header));
+    SaveComponents(state);
+    return total;
+}
+
+bool NES::LoadState(const uint8_t* buffer, size_t size) {
+    if (size < sizeof(SaveStateHeader)) {
+        return false;
+    }
+
+    SaveStateHeader header;
+    std::memcpy(&header, buffer, sizeof(header));
+    if (std::memcmp(header.magic, "NESSTATE", 8) != 0 || header.version != SAVE_STATE_VERSION ||
+        header.romHash != cartridge->romHash || header.size != StateSize() || size < header.size) {
+        return false;
+    }
+
+    // Finish the current timeline so nothing below runs the PPU or APU
+    ppu.Sync();
+    apu.Sync();
+
+    // The size check guarantees every read below is in bounds, but a
+    // corrupt body only shows while loading, so keep the current state to
+    // go back to
+    if (loadBackup.size() != header.size) {
+        loadBackup.resize(header.size);
+    }
+    SaveState(loadBackup.data(), loadBackup.size());
+
+    StateReader state(buffer + sizeof(header), header.size - sizeof(header));
+    LoadComponents(state);
+    if (state.Failed()) {
+        StateReader backup(loadBackup.data() + sizeof(header), loadBackup.size() - sizeof(header));
+        LoadComponents(backup);
+        return false;
+    }
+    return true;
+}
+
+bool NES::Fork(NES& child) {
+    if (&child == this || child.cartridge->romHash != cartridge->romHash) {
+        return false;
+    }
+    ppu.Sync();
+    apu.Sync();
+    child.ppu.Sync();
+    child.apu.Sync();
+
+    // Everything but the shared blocks goes over as a forking save state
+    if (forkState.empty()) {
+        StateWriter measure(nullptr, 0, true);
+        SaveComponents(measure);
+        forkState.resize(measure.Size());
+    }
+    StateWriter writer(forkState.data(), forkState.size(), true);
+    SaveComponents(writer);
+    StateReader reader(forkState.data(), forkState.size(), true);
+    child.LoadComponents(reader);
+
+    memory.Fork(child.memory);
+    ppu.Fork(child.ppu);
+    return true;
+}
+
+bool NES::SaveStateFile(const std::string& filename) {
+    std::vector<uint8_t> buffer(StateSize());
+    if (SaveState(buffer.data(), buffer.size()) == 0) {
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+    return file.good();
+}
+
+bool NES::LoadStateFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(StateSize());
+    file.read(reinterpret_cast<char*>(buffer.data()), buffer.size());
+    if ((size_t)file.gcount() != buffer.size()) {
+        return false;
+    }
+    return LoadState(buffer.data(), buffer.size());
+}
@@ -0,0 +1,86 @@
+// NES.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Cartridge.h"
+#include "PPU.h"
+#include "APU.h"
+#include "Memory.h"
+#include "CPU.h"
+#include "Controller.h"
+#include "Mapper.h"
+#include "SaveState.h"
+
+// Headless emulation core: owns the CPU, PPU, APU, bus and controller for one
+// cartridge and steps them together. Has no SDL dependency so it can be
+// driven by any front end (SDL window, batch runner, benchmarks).
+class NES {
+public:
+    // cart should be loaded. A cartridge without a mapper (Load() failed or
+    // was never called) gives a machine that is halted from the start:
+    // Running() is false and running it does nothing.
+    NES(Cartridge* cart);
+    void Reset();
+
+    // One CPU cycle. The PPU is synced lazily, so its state is only current
+    // after a frame completes or after RunCycles(). Returns true if a frame
+    // completed.
+    bool Clock();
+
+    // Run exactly n CPU cycles.
+    void RunCycles(uint32_t n);
+
+    // Run until the PPU finishes the current frame.
+    void RunFrame();
+
+    bool Running() const;
+    uint64_t FrameCount() const;
+    uint64_t CycleCount() const;
+
+    // Save states (format in SaveState.h). SaveState writes into a
+    // caller-provided buffer without allocating and returns the bytes
+    // written, or 0 if the buffer is smaller than StateSize(). LoadState
+    // rejects states from another version, another ROM or of the wrong
+    // size, and states with out-of-range fields, leaving the machine
+    // untouched. Front end settings (render and
+    // output mode, sample rate, attached trace) are not part of a state.
+    size_t StateSize();
+    size_t SaveState(uint8_t* buffer, size_t size);
+    bool LoadState(const uint8_t* buffer, size_t size);
+
+    // The same bytes in a file
+    bool SaveStateFile(const std::string& filename);
+    bool LoadStateFile(const std::string& filename);
+
+    // Copy-on-write fork for tree search: child, a machine running its own
+    // copy of this cartridge (Cartridge's copy constructor), continues from
+    // exactly this point. Internal RAM, name tables and CHR RAM are not
+    // copied but shared, page by page, until one side writes to a page and
+    // gets its own copy; registers, OAM, palette and PRG RAM are copied.
+    // Forking costs microseconds and a child's memory grows only with the
+    // pages it dirties, but building a machine does not, so keep children
+    // and fork into them again at every node. Neither machine may be
+    // running during the call; afterwards they can run on any threads.
+    // Returns false, leaving child untouched, if it runs another ROM.
+    bool Fork(NES& child);
+
+    Cartridge* cartridge;
+    PPU ppu;
+    APU apu;
+    Memory memory;
+    Controller controller1;
+    CPU cpu;
+
+private:
+    Mapper* mapper;
+    uint64_t frameCount;
+    uint64_t cycleCount;
+    size_t stateSize; // Fixed per cartridge; 0 until first measured
+    std::vector<uint8_t> forkState; // Scratch for Fork()
+    std::vector<uint8_t> loadBackup; // Scratch for LoadState()
+
+    void SaveComponents(StateWriter& state) const;
+    void LoadComponents(StateReader& state);
+};
@@ -1,5 +1,10 @@
 // PPU.cpp
 #include "PPU.h"
+#include "Mapper.h"
+#include "SaveState.h"
+#include "Simd.h"
+#include <algorithm>
+#include <array>
 #include <cstring>
 
 // NES color palette (simplified)
@@ -14,17 +19,127 @@ static const uint32_t nesPalette[64] = {
     0xFFFFE7A3, 0xFFE3FFA3, 0xFFABF3BF, 0xFFB3FFCF, 0xFF9FFFF3, 0xFF000000, 0xFF000000, 0xFF000000
 };
 
+// ARGB for a color index under the PPUMASK emphasis bits (5-7, shifted
+// down). Emphasis darkens the channels that are not emphasized.
+static uint32_t EmphasizeColor(uint8_t color, uint8_t emphasis) {
+    static const uint32_t channels[3] = { 0x00FF0000, 0x0000FF00, 0x000000FF }; // R, G, B
+
+    uint32_t argb = nesPalette[color & 0x3F];
+    for (int c = 0; c < 3; c++) {
+        if (emphasis & 0x07 & ~(1 << c)) {
+            uint32_t value = (argb & channels[c]) * 3 / 4;
+            argb = (argb & ~channels[c]) | (value & channels[c]);
+        }
+    }
+    return argb;
+}
+
+// Converts 256 palette RAM indices (0-31) to ARGB through a resolved table
+static void ResolveLine(const uint8_t* indices, const uint32_t* colors, uint32_t* out) {
+#if NES_SIMD_AVX2
+    // Widen eight indices to 32 bits and gather their colors
+    for (int x = 0; x < 256; x += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(indices + x)));
+        __m256i argb = _mm256_i32gather_epi32((const int*)colors, index, 4);
+        _mm256_storeu_si256((__m256i*)(out + x), argb);
+    }
+#elif NES_SIMD_SSSE3
+    // Split the table into byte planes so pshufb can look up 16 pixels at
+    // once. pshufb only indexes 16 entries, so entries 16-31 (sprites) are
+    // looked up separately and selected by bit 4 of the index.
+    __m128i planes[2][4];
+    for (int half = 0; half < 2; half++) {
+        for (int byte = 0; byte < 4; byte++) {
+            alignas(16) uint8_t plane[16];
+            for (int i = 0; i < 16; i++) {
+                plane[i] = (uint8_t)(colors[half * 16 + i] >> (byte * 8));
+            }
+            planes[half][byte] = _mm_load_si128((const __m128i*)plane);
+        }
+    }
+
+    const __m128i low4 = _mm_set1_epi8(0x0F);
+    const __m128i bit4 = _mm_set1_epi8(0x10);
+    for (int x = 0; x < 256; x += 16) {
+        __m128i index = _mm_loadu_si128((const __m128i*)(indices + x));
+        __m128i sprite = _mm_cmpeq_epi8(_mm_and_si128(index, bit4), bit4);
+        index = _mm_and_si128(index, low4);
+
+        __m128i bytes[4];
+        for (int byte = 0; byte < 4; byte++) {
+            __m128i bg = _mm_shuffle_epi8(planes[0][byte], index);
+            __m128i sp = _mm_shuffle_epi8(planes[1][byte], index);
+            bytes[byte] = _mm_or_si128(_mm_andnot_si128(sprite, bg), _mm_and_si128(sprite, sp));
+        }
+
+        // Interleave the planes back into 32-bit pixels
+        __m128i bg01Low = _mm_unpacklo_epi8(bytes[0], bytes[1]);
+        __m128i bg01High = _mm_unpackhi_epi8(bytes[0], bytes[1]);
+        __m128i bg23Low = _mm_unpacklo_epi8(bytes[2], bytes[3]);
+        __m128i bg23High = _mm_unpackhi_epi8(bytes[2], bytes[3]);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_unpacklo_epi16(bg01Low, bg23Low));
+        _mm_storeu_si128((__m128i*)(out + x + 4), _mm_unpackhi_epi16(bg01Low, bg23Low));
+        _mm_storeu_si128((__m128i*)(out + x + 8), _mm_unpacklo_epi16(bg01High, bg23High));
+        _mm_storeu_si128((__m128i*)(out + x + 12), _mm_unpackhi_epi16(bg01High, bg23High));
+    }
+#else
+    for (int x = 0; x < 256; x++) {
+        out[x] = colors[indices[x]];
+    }
+#endif
+}
+
+// Same as ResolveLine for indexed output: palette RAM index to color index
+static void ResolveLineIndexed(const uint8_t* indices, const uint8_t* colors, uint8_t* out) {
+#if NES_SIMD_SSSE3
+    const __m128i low = _mm_loadu_si128((const __m128i*)colors);
+    const __m128i high = _mm_loadu_si128((const __m128i*)(colors + 16));
+    const __m128i low4 = _mm_set1_epi8(0x0F);
+    const __m128i bit4 = _mm_set1_epi8(0x10);
+    for (int x = 0; x < 256; x += 16) {
+        __m128i index = _mm_loadu_si128((const __m128i*)(indices + x));
+        __m128i sprite = _mm_cmpeq_epi8(_mm_and_si128(index, bit4), bit4);
+        index = _mm_and_si128(index, low4);
+        __m128i bg = _mm_shuffle_epi8(low, index);
+        __m128i sp = _mm_shuffle_epi8(high, index);
+        _mm_storeu_si128((__m128i*)(out + x), _mm_or_si128(_mm_andnot_si128(sprite, bg), _mm_and_si128(sprite, sp)));
+    }
+#else
+    for (int x = 0; x < 256; x++) {
+        out[x] = colors[indices[x]];
+    }
+#endif
+}
+
 PPU::PPU(Cartridge* cart)
-    : cartridge(cart), frameComplete(false), scanline(0), cycle(0), nmi(false) {
+    : nmi(false), cartridge(cart), nameTable(1024, 2), frameBuffer(frameStorage), outputMode(OUTPUT_ARGB),
+      indexBuffer(indexStorage), scanline(0), cycle(0), frameComplete(false),
+      renderMode(RENDER_SCANLINE), lineDotMode(false), cpuClock(nullptr), chrRam(1024, 8),
+      scanlineCounter(nullptr), chrRamDecoded(4096, 8) {
+    std::memset(chrRamBanks, -1, sizeof(chrRamBanks));
+    std::memset(nameTableBanks, 0, sizeof(nameTableBanks));
     Reset();
+
+    // Flat 8KB CHR until a mapper takes over
+    if (cartridge->CHR_ROM.size() >= 8192) {
+        MapCHRRom(0, 8, cartridge->CHR_ROM.data());
+    }
+    else {
+        MapCHRRam(0, 8, 0);
+    }
+    SetMirroring(cartridge->mirror);
 }
 
 void PPU::Reset() {
-    std::memset(nameTable, 0, sizeof(nameTable));
+    nameTable.Clear();
     std::memset(palette, 0, sizeof(palette));
     std::memset(OAM, 0, sizeof(OAM));
-    std::memset(frameBuffer, 0, sizeof(frameBuffer));
-    std::memset(chrRam, 0, sizeof(chrRam)); // Initialize CHR RAM if needed
+    std::memset(frameBuffer, 0, sizeof(frameStorage));
+    std::memset(indexBuffer, 0, sizeof(indexStorage));
+    std::memset(lineEmphasis, 0, sizeof(lineEmphasis));
+    chrRam.Clear(); // Initialize CHR RAM if needed
+    chrRamDecoded.Clear();
+    RemapSharedPages();
 
     vramAddr = 0;
     tempAddr = 0;
@@ -44,6 +159,16 @@ void PPU::Reset() {
     bgShiftPatternHigh = 0;
     bgShiftAttribLow = 0;
     bgShiftAttribHigh = 0;
+
+    ResolvePalette();
+
+    std::memset(spriteLine, 0, sizeof(spriteLine));
+    spriteCount = 0;
+    spriteZeroOnLine = false;
+
+    dotCount = 0;
+    frameCount = 0;
+    UpdateNextEvent();
 }
 
 void PPU::Clock() {
@@ -55,57 +180,41 @@ void PPU::Clock() {
         }
     }
 
-    // Clear VBlank flag at the end of VBlank
+    // Clear VBlank, sprite 0 hit and sprite overflow at the end of VBlank
     if (scanline == -1 && cycle == 1) {
-        regStatus &= ~0x80; // Clear VBlank flag
+        regStatus &= ~0xE0;
         frameComplete = false;
     }
 
-    // Visible scanlines (0-239)
-    if (scanline >= 0 && scanline < 240) {
-        if ((cycle >= 2 && cycle <= 257) || (cycle >= 321 && cycle <= 337)) {
-            UpdateShifters();
-
-            switch ((cycle - 1) % 8) {
-            case 0:
-                LoadBackgroundShifters();
-                FetchBackgroundTile();
-                break;
-            case 2:
-                FetchBackgroundTileAttrib();
-                break;
-            case 4:
-                FetchBackgroundTileLsb();
-                break;
-            case 6:
-                FetchBackgroundTileMsb();
-                break;
-            case 7:
-                IncrementScrollX();
-                break;
-            }
+    // Rendering scanlines (pre-render -1 and visible 0-239)
+    if (scanline >= -1 && scanline < 240) {
+        if (cycle == 0) {
+            lineDotMode = (renderMode == RENDER_DOT);
         }
 
-        if (cycle == 256) {
-            IncrementScrollY();
+        if (!lineDotMode && cycle >= 1 && cycle <= 256) {
+            // Scanline mode: dots 1-256 are produced in one batch
+            if (cycle == 256) {
+                RenderScanline();
+            }
         }
-
-        if (cycle == 257) {
-            LoadBackgroundShifters();
-            TransferAddressX();
+        else {
+            StepBackground();
         }
+    }
 
-        if (scanline == -1 && cycle >= 280 && cycle <= 304) {
-            TransferAddressY();
-        }
+    // Sprites for the next line
+    if (cycle == 257 && scanline >= -1 && scanline < 240) {
+        EvaluateSprites();
+    }
 
-        // Render pixel
-        if (cycle >= 1 && cycle <= 256) {
-            RenderPixel();
-        }
+    // Mapper scanline counter (MMC3 sees PPU A12 rise near dot 260)
+    if (cycle == 260 && scanline < 240 && scanlineCounter && (regMask & 0x18)) {
+        scanlineCounter->Scanline();
     }
 
     // Increment cycle and scanline
+    dotCount++;
     cycle++;
     if (cycle >= 341) {
         cycle = 0;
@@ -113,17 +222,359 @@ void PPU::Clock() {
         if (scanline >= 261) {
             scanline = -1;
             frameComplete = true;
+            frameCount++;
+        }
+    }
+}
+
+void PPU::ConnectClock(const uint64_t* cpuCycles) {
+    cpuClock = cpuCycles;
+    UpdateNextEvent();
+}
+
+// Runs the PPU up to the current CPU cycle (three dots per CPU cycle)
+void PPU::Sync() {
+    if (!cpuClock) {
+        return;
+    }
+
+    uint64_t target = *cpuClock * 3;
+    while (dotCount < target) {
+        // The post-render and VBlank lines only set VBlank at (241, 1) and
+        // wrap the frame at the end of line 260, so skip to the next of those
+        if (scanline >= 240) {
+            int pos = (scanline + 1) * 341 + cycle;
+            int next = (pos <= 242 * 341 + 1) ? 242 * 341 + 1 : 261 * 341 + 340;
+            uint64_t skip = std::min<uint64_t>(next - pos, target - dotCount);
+            pos += (int)skip;
+            scanline = pos / 341 - 1;
+            cycle = pos % 341;
+            dotCount += skip;
+            if (dotCount == target) {
+                break;
+            }
+        }
+        Clock();
+    }
+
+    UpdateNextEvent();
+}
+
+uint64_t PPU::FrameCount() const {
+    return frameCount;
+}
+
+void PPU::SaveState(StateWriter& state) const {
+    // Name tables and CHR RAM are shared rather than copied into a fork
+    if (!state.Forking()) {
+        for (int bank = 0; bank < 2; bank++) {
+            state.WriteBytes(nameTable.Page(bank), 1024);
         }
     }
+    state.WriteBytes(palette, sizeof(palette));
+    state.WriteBytes(OAM, sizeof(OAM));
+    if (cartridge->CHR_ROM.empty() && !state.Forking()) {
+        for (int bank = 0; bank < 8; bank++) {
+            state.WriteBytes(chrRam.Page(bank), 1024);
+        }
+    }
+
+    state.Write(nmi);
+    state.Write(regOAMAddr);
+    state.Write(vramAddr);
+    state.Write(tempAddr);
+    state.Write(fineX);
+    state.Write(writeToggle);
+    state.Write(ppuDataBuffer);
+    state.Write(regControl);
+    state.Write(regMask);
+    state.Write(regStatus);
+
+    state.Write(scanline);
+    state.Write(cycle);
+    state.Write(frameComplete);
+    state.Write(lineDotMode);
+    state.Write(dotCount);
+    state.Write(frameCount);
+
+    state.Write(bgNextTileID);
+    state.Write(bgNextTileAttrib);
+    state.Write(bgNextTileLsb);
+    state.Write(bgNextTileMsb);
+    state.Write(bgShiftPatternLow);
+    state.Write(bgShiftPatternHigh);
+    state.Write(bgShiftAttribLow);
+    state.Write(bgShiftAttribHigh);
+
+    state.WriteBytes(spriteLine, sizeof(spriteLine));
+    state.Write(spriteCount);
+    state.Write(spriteZeroOnLine);
+}
+
+void PPU::LoadState(StateReader& state) {
+    if (!state.Forking()) {
+        for (int bank = 0; bank < 2; bank++) {
+            state.ReadBytes(nameTable.Writable(bank), 1024);
+        }
+    }
+    state.ReadBytes(palette, sizeof(palette));
+    state.ReadBytes(OAM, sizeof(OAM));
+    if (cartridge->CHR_ROM.empty() && !state.Forking()) {
+        // Re-decode only the tiles that differ from the current CHR RAM,
+        // which between nearby states is usually none of them (and those
+        // pages stay shared with a fork)
+        uint8_t saved[16];
+        for (int tile = 0; tile < 8192; tile += 16) {
+            state.ReadBytes(saved, sizeof(saved));
+            int bank = tile >> 10;
+            int offset = tile & 0x03FF;
+            if (std::memcmp(saved, chrRam.Page(bank) + offset, sizeof(saved)) != 0) {
+                std::memcpy(chrRam.Writable(bank) + offset, saved, sizeof(saved));
+                uint8_t* decoded = chrRamDecoded.Writable(bank) + offset * 4;
+                for (int row = 0; row < 8; row++) {
+                    Cartridge::DecodeCHRRow(saved[row], saved[row + 8], decoded + row * 8);
+                }
+            }
+        }
+    }
+    RemapSharedPages();
+
+    state.Read(nmi);
+    state.Read(regOAMAddr);
+    state.Read(vramAddr);
+    state.Read(tempAddr);
+    state.ReadRange<uint8_t>(fineX, 0, 7);
+    state.Read(writeToggle);
+    state.Read(ppuDataBuffer);
+    state.Read(regControl);
+    state.Read(regMask);
+    state.Read(regStatus);
+
+    state.ReadRange(scanline, -1, 260);
+    state.ReadRange(cycle, 0, 340);
+    state.Read(frameComplete);
+    state.Read(lineDotMode);
+    // Saved synced, at three dots per CPU cycle; anything else would send
+    // Sync() into an endless catch-up
+    if (cpuClock) {
+        state.ReadRange(dotCount, *cpuClock * 3, *cpuClock * 3);
+    }
+    else {
+        state.Read(dotCount);
+    }
+    state.Read(frameCount);
+
+    state.Read(bgNextTileID);
+    state.ReadRange<uint8_t>(bgNextTileAttrib, 0, 3);
+    state.Read(bgNextTileLsb);
+    state.Read(bgNextTileMsb);
+    state.Read(bgShiftPatternLow);
+    state.Read(bgShiftPatternHigh);
+    state.Read(bgShiftAttribLow);
+    state.Read(bgShiftAttribHigh);
+
+    state.ReadBytes(spriteLine, sizeof(spriteLine));
+    state.ReadRange(spriteCount, 0, 8);
+    state.Read(spriteZeroOnLine);
+
+    ResolvePalette();
+    UpdateNextEvent();
+}
+
+// Predicts the next dot the CPU can observe without accessing the PPU.
+// Positions count dots from the start of the pre-render line; anything
+// that changes the prediction ($2000/$2001 writes) syncs first.
+void PPU::UpdateNextEvent() {
+    int pos = (scanline + 1) * 341 + cycle;
+    int event = 261 * 341 + 340; // Frame wrap
+
+    if ((regControl & 0x80) && pos <= 242 * 341 + 1) {
+        event = 242 * 341 + 1; // VBlank NMI at (241, 1)
+    }
+
+    if (scanlineCounter && (regMask & 0x18)) {
+        int line = (cycle <= 260) ? scanline : scanline + 1;
+        if (line < 240) {
+            event = std::min(event, (line + 1) * 341 + 260);
+        }
+    }
+
+    nextEventDot = dotCount + (event - pos) + 1;
+}
+
+// One dot of the background pipeline (dot-accurate path)
+void PPU::StepBackground() {
+    if ((cycle >= 2 && cycle <= 257) || (cycle >= 321 && cycle <= 337)) {
+        UpdateShifters();
+
+        switch ((cycle - 1) % 8) {
+        case 0:
+            LoadBackgroundShifters();
+            FetchBackgroundTile();
+            break;
+        case 2:
+            FetchBackgroundTileAttrib();
+            break;
+        case 4:
+            FetchBackgroundTileLsb();
+            break;
+        case 6:
+            FetchBackgroundTileMsb();
+            break;
+        case 7:
+            IncrementScrollX();
+            break;
+        }
+    }
+
+    if (cycle == 256) {
+        IncrementScrollY();
+    }
+
+    if (cycle == 257) {
+        LoadBackgroundShifters();
+        TransferAddressX();
+    }
+
+    if (scanline == -1 && cycle >= 280 && cycle <= 304) {
+        TransferAddressY();
+    }
+
+    // Render pixel
+    if (scanline >= 0 && cycle >= 1 && cycle <= 256) {
+        RenderPixel();
+    }
+}
+
+// Produces dots 1-256 of the current line at once. Equivalent to running
+// StepBackground over those dots as long as no PPU state changes in between,
+// which CatchUp() guarantees by switching the line to the dot path first.
+void PPU::RenderScanline() {
+    // Background pixels for tiles 0-33 as (palette << 2) | pixel. Tiles 0
+    // and 1 were prefetched at dots 321-336 of the previous line and sit in
+    // the shifters; they are unpacked bit by bit since rendering toggled
+    // mid-prefetch can leave their shifted-in attribute bits non-uniform.
+    uint8_t bgLine[34 * 8];
+    for (int tile = 0; tile < 2; tile++) {
+        int shift = 8 - tile * 8;
+        uint64_t pixels, palettes;
+        Cartridge::DecodeCHRRow(bgShiftPatternLow >> shift, bgShiftPatternHigh >> shift, (uint8_t*)&pixels);
+        Cartridge::DecodeCHRRow(bgShiftAttribLow >> shift, bgShiftAttribHigh >> shift, (uint8_t*)&palettes);
+        pixels |= palettes << 2;
+        std::memcpy(&bgLine[tile * 8], &pixels, 8);
+    }
+
+    // Tiles 2-33 are fetched here and copied from the decoded CHR cache
+    // eight pixels at a time. Raw pattern bytes are only read for tiles
+    // 31-33, which end up in the shifters and latches.
+    uint8_t tailLsb[2] = { 0, 0 };
+    uint8_t tailMsb[2] = { 0, 0 };
+    uint8_t tailAttrib[2] = { 0, 0 };
+    uint16_t patternBase = ((regControl & 0x10) << 8) + FineY();
+
+    for (int tile = 2; tile < 34; tile++) {
+        // Tile 2's name table byte was already fetched at dot 337
+        if (tile > 2) {
+            FetchBackgroundTile();
+        }
+        FetchBackgroundTileAttrib();
+
+        uint64_t pixels;
+        std::memcpy(&pixels, DecodedCHRRow(patternBase + (bgNextTileID << 4)), 8);
+        pixels |= bgNextTileAttrib * 0x0404040404040404ULL;
+        std::memcpy(&bgLine[tile * 8], &pixels, 8);
+
+        if (tile >= 31) {
+            FetchBackgroundTileLsb();
+            FetchBackgroundTileMsb();
+            if (tile < 33) {
+                tailLsb[tile - 31] = bgNextTileLsb;
+                tailMsb[tile - 31] = bgNextTileMsb;
+                tailAttrib[tile - 31] = bgNextTileAttrib;
+            }
+        }
+        IncrementScrollX();
+    }
+    IncrementScrollY();
+
+    // Without output only sprite 0 hits need the composited line
+    if (scanline >= 0 && (outputMode != OUTPUT_NONE || spriteZeroOnLine)) {
+        // Lines without sprites or left-column clipping resolve the
+        // background indices directly; the rest composite first
+        const uint8_t* indices = bgLine + fineX;
+        uint8_t composed[256];
+        if (spriteCount != 0 || (regMask & 0x0A) != 0x0A) {
+            for (int x = 0; x < 256; x++) {
+                uint8_t value = (regMask & 0x08) ? bgLine[x + fineX] : 0;
+                composed[x] = ComposePixel(x, value & 0x03, value >> 2);
+            }
+            indices = composed;
+        }
+
+        lineEmphasis[scanline] = regMask >> 5;
+        if (outputMode == OUTPUT_INDEXED) {
+            ResolveLineIndexed(indices, paletteIndex, &indexBuffer[scanline * 256]);
+        }
+        else if (outputMode == OUTPUT_ARGB) {
+            ResolveLine(indices, paletteARGB, &frameBuffer[scanline * 256]);
+        }
+    }
+
+    // Leave the shifters as the dot path would after dot 256: tile 32 was
+    // loaded at dot 249 and shifted 7 times if background rendering is on
+    uint8_t attribLow[2];
+    uint8_t attribHigh[2];
+    for (int i = 0; i < 2; i++) {
+        attribLow[i] = (tailAttrib[i] & 0x01) ? 0xFF : 0x00;
+        attribHigh[i] = (tailAttrib[i] & 0x02) ? 0xFF : 0x00;
+    }
+
+    if (regMask & 0x08) {
+        bgShiftPatternLow = (uint16_t)((((tailLsb[0] << 8) | tailLsb[1]) << 7) & 0xFFFF);
+        bgShiftPatternHigh = (uint16_t)((((tailMsb[0] << 8) | tailMsb[1]) << 7) & 0xFFFF);
+        bgShiftAttribLow = (uint16_t)((((attribLow[0] << 8) | attribLow[1]) << 7) & 0xFFFF);
+        bgShiftAttribHigh = (uint16_t)((((attribHigh[0] << 8) | attribHigh[1]) << 7) & 0xFFFF);
+    }
+    else {
+        bgShiftPatternLow = (bgShiftPatternLow & 0xFF00) | tailLsb[1];
+        bgShiftPatternHigh = (bgShiftPatternHigh & 0xFF00) | tailMsb[1];
+        bgShiftAttribLow = (bgShiftAttribLow & 0xFF00) | attribLow[1];
+        bgShiftAttribHigh = (bgShiftAttribHigh & 0xFF00) | attribHigh[1];
+    }
+}
+
+// Called before anything that changes rendering state (register access,
+// bank switch). If the current line is being batched and has already
+// started, replay its elapsed dots on the dot path and finish it there.
+void PPU::CatchUp() {
+    if (lineDotMode || scanline < -1 || scanline >= 240 || cycle < 2 || cycle > 256) {
+        return;
+    }
+
+    int target = cycle;
+    for (cycle = 1; cycle < target; cycle++) {
+        StepBackground();
+    }
+    lineDotMode = true;
+}
+
+void PPU::SetRenderMode(RenderMode mode) {
+    renderMode = mode;
 }
 
 // CPU Interface
 uint8_t PPU::CPURead(uint16_t addr) {
+    Sync();
+
     uint8_t data = 0x00;
     addr &= 0x2007;
 
     switch (addr) {
     case 0x2002: // PPUSTATUS
+        // A batched line would only report sprite 0 hit at its end
+        if (spriteZeroOnLine) {
+            CatchUp();
+        }
         data = regStatus;
         regStatus &= ~0x80; // Clear VBlank flag
         writeToggle = 0;
@@ -132,6 +583,7 @@ uint8_t PPU::CPURead(uint16_t addr) {
         data = OAM[regOAMAddr];
         break;
     case 0x2007: // PPUDATA
+        CatchUp();
         data = ppuDataBuffer;
         ppuDataBuffer = PPURead(vramAddr);
 
@@ -153,14 +605,26 @@ uint8_t PPU::CPURead(uint16_t addr) {
 void PPU::CPUWrite(uint16_t addr, uint8_t data) {
     addr &= 0x2007;
 
+    Sync();
+    if (addr != 0x2003 && addr != 0x2004) {
+        CatchUp();
+    }
+
     switch (addr) {
     case 0x2000: // PPUCTRL
         regControl = data;
         tempAddr = (tempAddr & 0xF3FF) | ((data & 0x03) << 10);
+        UpdateNextEvent(); // NMI enable
         break;
-    case 0x2001: // PPUMASK
+    case 0x2001: { // PPUMASK
+        bool recolor = ((regMask ^ data) & 0xE1) != 0; // Greyscale or emphasis changed
         regMask = data;
+        if (recolor) {
+            ResolvePalette();
+        }
+        UpdateNextEvent(); // Mapper scanline ticks need rendering on
         break;
+    }
     case 0x2003: // OAMADDR
         regOAMAddr = data;
         break;
@@ -206,21 +670,12 @@ uint8_t PPU::PPURead(uint16_t addr) {
     uint8_t data = 0x00;
 
     if (addr < 0x2000) {
-        // Pattern tables (CHR ROM or CHR RAM)
-        if (cartridge->CHR_ROM.size() == 0) {
-            // CHR RAM
-            data = chrRam[addr];
-        }
-        else {
-            // CHR ROM
-            data = cartridge->CHR_ROM[addr];
-        }
+        // Pattern tables (CHR ROM or CHR RAM, banked by the mapper)
+        data = chrPages[addr >> 10][addr & 0x03FF];
     }
     else if (addr >= 0x2000 && addr < 0x3F00) {
         // Name tables with mirroring
-        addr &= 0x0FFF;
-        uint16_t mirroredAddr = MirrorAddress(addr);
-        data = nameTable[(mirroredAddr / 0x0400) % 2][mirroredAddr % 0x0400];
+        data = nameTablePages[(addr >> 10) & 0x03][addr & 0x03FF];
     }
     else if (addr >= 0x3F00 && addr < 0x4000) {
         // Palette RAM indexes
@@ -239,18 +694,33 @@ void PPU::PPUWrite(uint16_t addr, uint8_t data) {
     addr &= 0x3FFF;
 
     if (addr < 0x2000) {
-        // Pattern tables (CHR RAM)
-        if (cartridge->CHR_ROM.size() == 0) {
-            // CHR RAM
-            chrRam[addr] = data;
+        // Pattern tables (CHR RAM); for CHR ROM, writes are ignored
+        int bank = chrRamBanks[addr >> 10];
+        if (bank >= 0) {
+            uint8_t* page = chrWritePages[addr >> 10];
+            if (!page) {
+                // Still shared with a fork
+                page = chrRam.Writable(bank);
+                chrRamDecoded.Writable(bank);
+                RemapSharedPages();
+            }
+            page[addr & 0x03FF] = data;
+
+            // Re-decode the row this byte belongs to
+            int row = addr & 0x03F7;
+            uint8_t* decoded = chrRamDecoded.Writable(bank);
+            Cartridge::DecodeCHRRow(page[row], page[row + 8], &decoded[((row & 0x03F0) << 2) | ((row & 0x07) << 3)]);
         }
-        // For CHR ROM, writes are ignored
     }
     else if (addr >= 0x2000 && addr < 0x3F00) {
         // Name tables with mirroring
-        addr &= 0x0FFF;
-        uint16_t mirroredAddr = MirrorAddress(addr);
-        nameTable[(mirroredAddr / 0x0400) % 2][mirroredAddr % 0x0400] = data;
+        uint8_t* page = nameTableWritePages[(addr >> 10) & 0x03];
+        if (!page) {
+            // Still shared with a fork
+            page = nameTable.Writable(nameTableBanks[(addr >> 10) & 0x03]);
+            RemapSharedPages();
+        }
+        page[addr & 0x03FF] = data;
     }
     else if (addr >= 0x3F00 && addr < 0x4000) {
         // Palette RAM indexes
@@ -260,6 +730,17 @@ void PPU::PPUWrite(uint16_t addr, uint8_t data) {
         if (addr == 0x0018) addr = 0x0008;
         if (addr == 0x001C) addr = 0x000C;
         palette[addr] = data;
+
+        // Entry 0 is the backdrop behind every palette; entries 4, 8 and C
+        // are stored but never displayed
+        if (addr == 0x0000) {
+            for (int i = 0; i < 32; i += 4) {
+                ResolvePaletteEntry(i, data);
+            }
+        }
+        else if (addr & 0x03) {
+            ResolvePaletteEntry(addr, data);
+        }
     }
 }
 
@@ -269,21 +750,83 @@ bool PPU::FrameReady() {
 }
 
 uint32_t* PPU::GetFrameBuffer() {
+    if (outputMode == OUTPUT_INDEXED) {
+        ConvertToARGB(indexBuffer, lineEmphasis, frameBuffer);
+    }
     return frameBuffer;
 }
 
-uint8_t PPU::GetColorFromPaletteRAM(uint8_t paletteNum, uint8_t pixel) {
-    if (pixel == 0) {
-        return PPURead(0x3F00) & 0x3F;
+void PPU::SetFrameBuffer(uint32_t* buffer) {
+    frameBuffer = buffer ? buffer : frameStorage;
+}
+
+void PPU::SetOutputMode(OutputMode mode) {
+    outputMode = mode;
+}
+
+PPU::OutputMode PPU::GetOutputMode() const {
+    return outputMode;
+}
+
+const uint8_t* PPU::GetIndexBuffer() const {
+    return indexBuffer;
+}
+
+void PPU::SetIndexBuffer(uint8_t* buffer) {
+    indexBuffer = buffer ? buffer : indexStorage;
+}
+
+const uint8_t* PPU::GetLineEmphasis() const {
+    return lineEmphasis;
+}
+
+void PPU::ConvertToARGB(const uint8_t* indices, const uint8_t* emphasis, uint32_t* out) {
+    // One 64-color table per emphasis combination, built on first use
+    static const std::array<std::array<uint32_t, 64>, 8> tables = [] {
+        std::array<std::array<uint32_t, 64>, 8> t;
+        for (int e = 0; e < 8; e++) {
+            for (int c = 0; c < 64; c++) {
+                t[e][c] = EmphasizeColor(c, e);
+            }
+        }
+        return t;
+    }();
+
+    for (int y = 0; y < 240; y++) {
+        const uint32_t* colors = tables[emphasis[y] & 0x07].data();
+        const uint8_t* line = indices + y * 256;
+        uint32_t* dest = out + y * 256;
+#if NES_SIMD_AVX2
+        for (int x = 0; x < 256; x += 8) {
+            __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(line + x)));
+            _mm256_storeu_si256((__m256i*)(dest + x), _mm256_i32gather_epi32((const int*)colors, index, 4));
+        }
+#else
+        for (int x = 0; x < 256; x++) {
+            dest[x] = colors[line[x] & 0x3F];
+        }
+#endif
     }
-    else {
-        return PPURead(0x3F00 + (paletteNum << 2) + pixel) & 0x3F;
+}
+
+// Color index for a palette RAM value under the current greyscale bit
+uint8_t PPU::ResolveIndex(uint8_t color) const {
+    color &= 0x3F;
+    if (regMask & 0x01) { // Greyscale
+        color &= 0x30;
     }
+    return color;
+}
+
+void PPU::ResolvePaletteEntry(int entry, uint8_t color) {
+    uint8_t index = ResolveIndex(color);
+    paletteIndex[entry] = index;
+    paletteARGB[entry] = EmphasizeColor(index, regMask >> 5);
 }
 
-void PPU::SetPixel(int x, int y, uint8_t color) {
-    if (x >= 0 && x < 256 && y >= 0 && y < 240) {
-        frameBuffer[y * 256 + x] = nesPalette[color];
+void PPU::ResolvePalette() {
+    for (int i = 0; i < 32; i++) {
+        ResolvePaletteEntry(i, palette[(i & 0x03) ? i : 0]);
     }
 }
 
@@ -312,6 +855,11 @@ void PPU::FetchBackgroundTileMsb() {
     bgNextTileMsb = PPURead(tileAddr);
 }
 
+// Decoded pixels of the pattern row at addr (the plane bit is ignored)
+const uint8_t* PPU::DecodedCHRRow(uint16_t addr) {
+    return chrDecodedPages[(addr >> 10) & 0x07] + ((addr & 0x03F0) << 2) + ((addr & 0x07) << 3);
+}
+
 void PPU::LoadBackgroundShifters() {
     bgShiftPatternLow = (bgShiftPatternLow & 0xFF00) | bgNextTileLsb;
     bgShiftPatternHigh = (bgShiftPatternHigh & 0xFF00) | bgNextTileMsb;
@@ -349,9 +897,112 @@ void PPU::RenderPixel() {
         bg_palette = (attrib1 << 1) | attrib0;
     }
 
-    uint8_t color = GetColorFromPaletteRAM(bg_palette, bg_pixel);
+    uint8_t index = ComposePixel(x, bg_pixel, bg_palette);
+    if (x == 0) {
+        lineEmphasis[y] = regMask >> 5;
+    }
+    if (outputMode == OUTPUT_INDEXED) {
+        indexBuffer[y * 256 + x] = paletteIndex[index];
+    }
+    else if (outputMode == OUTPUT_ARGB) {
+        frameBuffer[y * 256 + x] = paletteARGB[index];
+    }
+}
+
+// Finds the first eight sprites on the next line and decodes their pattern
+// rows into spriteLine, so compositing is a single lookup per pixel. Lower
+// OAM indices win, even when their pixel ends up behind the background.
+void PPU::EvaluateSprites() {
+    if (spriteCount > 0) {
+        std::memset(spriteLine, 0, sizeof(spriteLine));
+    }
+    spriteCount = 0;
+    spriteZeroOnLine = false;
+
+    // Sprites are never drawn on line 0, and nothing is evaluated while
+    // rendering is off
+    if (scanline < 0 || !(regMask & 0x18)) {
+        return;
+    }
+
+    int height = (regControl & 0x20) ? 16 : 8;
+
+    for (int i = 0; i < 64; i++) {
+        // OAM Y is one less than the first line the sprite appears on
+        int row = scanline - OAM[i * 4];
+        if (row < 0 || row >= height) {
+            continue;
+        }
+
+        if (spriteCount == 8) {
+            regStatus |= 0x20; // Sprite overflow
+            break;
+        }
+        spriteCount++;
+
+        uint8_t tile = OAM[i * 4 + 1];
+        uint8_t attrib = OAM[i * 4 + 2];
+        int x = OAM[i * 4 + 3];
+
+        if (attrib & 0x80) { // Vertical flip
+            row = height - 1 - row;
+        }
+
+        uint16_t tileAddr;
+        if (height == 16) {
+            tileAddr = ((tile & 0x01) << 12) | ((tile & 0xFE) << 4);
+            if (row >= 8) {
+                tileAddr += 16;
+                row -= 8;
+            }
+        }
+        else {
+            tileAddr = ((regControl & 0x08) << 9) | (tile << 4);
+        }
+
+        const uint8_t* pixels = DecodedCHRRow(tileAddr + row);
+        uint64_t opaque;
+        std::memcpy(&opaque, pixels, 8);
+        if (opaque == 0) {
+            continue;
+        }
+
+        uint8_t flags = ((attrib & 0x03) << 2) | ((attrib & 0x20) >> 1) | (i == 0 ? 0x20 : 0x00);
+        if (i == 0) {
+            spriteZeroOnLine = true;
+        }
+
+        for (int k = 0; k < 8 && x + k < 256; k++) {
+            uint8_t pixel = pixels[(attrib & 0x40) ? 7 - k : k]; // Horizontal flip
+            if (pixel != 0 && spriteLine[x + k] == 0) {
+                spriteLine[x + k] = flags | pixel;
+            }
+        }
+    }
+}
+
+// Combines a background pixel with the sprite line, applying left-column
+// clipping and priority, and records sprite 0 hits. Returns the palette RAM
+// index ((palette << 2) | pixel, sprites at 0x10-0x1F), 0 for the backdrop.
+uint8_t PPU::ComposePixel(int x, uint8_t bgPixel, uint8_t bgPalette) {
+    if (x < 8 && !(regMask & 0x02)) {
+        bgPixel = 0;
+    }
+    uint8_t background = bgPixel ? (bgPalette << 2) | bgPixel : 0;
+
+    uint8_t sprite = spriteLine[x];
+    if (sprite == 0 || !(regMask & 0x10) || (x < 8 && !(regMask & 0x04))) {
+        return background;
+    }
 
-    SetPixel(x, y, color);
+    if ((sprite & 0x20) && bgPixel != 0 && x != 255) {
+        regStatus |= 0x40; // Sprite 0 hit
+    }
+
+    if (bgPixel != 0 && (sprite & 0x10)) {
+        return background;
+    }
+    return 0x10 | (sprite & 0x0F);
 }
 
 void PPU::IncrementScrollX() {
@@ -405,22 +1056,73 @@ uint8_t PPU::FineY() {
     return (vramAddr >> 12) & 0x07;
 }
 
-uint16_t PPU::MirrorAddress(uint16_t addr) {
-    if (cartridge->mirror == Cartridge::VERTICAL) {
-        return addr;
+void PPU::MapCHRRom(int firstPage, int count, const uint8_t* data) {
+    Sync();
+    CatchUp();
+    const uint8_t* decoded = cartridge->CHR_Decoded.data() + (data - cartridge->CHR_ROM.data()) * 4;
+    for (int i = 0; i < count; i++) {
+        chrPages[firstPage + i] = data + i * 0x0400;
+        chrWritePages[firstPage + i] = nullptr;
+        chrDecodedPages[firstPage + i] = decoded + i * 0x1000;
+        chrRamBanks[firstPage + i] = -1;
     }
-    else if (cartridge->mirror == Cartridge::HORIZONTAL) {
-        if (addr >= 0x0000 && addr < 0x0400)
-            return addr;
-        else if (addr >= 0x0400 && addr < 0x0800)
-            return addr - 0x0400;
-        else if (addr >= 0x0800 && addr < 0x0C00)
-            return addr - 0x0800;
-        else
-            return addr - 0x0C00;
+}
+
+void PPU::MapCHRRam(int firstPage, int count, uint32_t offset) {
+    Sync();
+    CatchUp();
+    for (int i = 0; i < count; i++) {
+        chrRamBanks[firstPage + i] = (int8_t)(((offset + i * 0x0400) & 0x1FFF) >> 10);
     }
-    else {
-        // Handle other mirroring types if necessary
-        return addr;
+    RemapSharedPages();
+}
+
+void PPU::SetMirroring(Cartridge::Mirror mirror) {
+    Sync();
+    CatchUp();
+    // Name table index for each of the four logical tables
+    static const uint8_t layouts[][4] = {
+        { 0, 0, 1, 1 }, // HORIZONTAL
+        { 0, 1, 0, 1 }, // VERTICAL
+        { 0, 1, 0, 1 }, // FOUR_SCREEN (only 2KB of VRAM, falls back to vertical)
+        { 0, 0, 0, 0 }, // SINGLE_SCREEN_LOW
+        { 1, 1, 1, 1 }, // SINGLE_SCREEN_HIGH
+    };
+    for (int i = 0; i < 4; i++) {
+        nameTableBanks[i] = layouts[mirror][i];
+    }
+    RemapSharedPages();
+}
+
+// Points the name table and CHR RAM slots at their current pages. Pages
+// still shared with a fork get no write pointer, so the first write takes
+// a private copy.
+void PPU::RemapSharedPages() {
+    for (int i = 0; i < 4; i++) {
+        int bank = nameTableBanks[i];
+        nameTablePages[i] = nameTable.Page(bank);
+        nameTableWritePages[i] = nameTable.Shared(bank) ? nullptr : nameTable.Writable(bank);
+    }
+    for (int i = 0; i < 8; i++) {
+        int bank = chrRamBanks[i];
+        if (bank >= 0) {
+            chrPages[i] = chrRam.Page(bank);
+            chrWritePages[i] = chrRam.Shared(bank) ? nullptr : chrRam.Writable(bank);
+            chrDecodedPages[i] = chrRamDecoded.Page(bank);
+        }
     }
 }
+
+void PPU::Fork(PPU& child) {
+    nameTable.Fork(child.nameTable);
+    chrRam.Fork(child.chrRam);
+    chrRamDecoded.Fork(child.chrRamDecoded);
+    RemapSharedPages();
+    child.RemapSharedPages();
+}
+
+void PPU::SetScanlineCounter(Mapper* mapper) {
+    Sync();
+    scanlineCounter = mapper;
+    UpdateNextEvent();
+}
@@ -2,6 +2,11 @@
 #pragma once
 #include <cstdint>
 #include "Cartridge.h"
+#include "SharedPages.h"
+
+class Mapper;
+class StateReader;
+class StateWriter;
 
 class PPU {
 public:
@@ -17,10 +22,68 @@ public:
     uint8_t PPURead(uint16_t addr);
     void PPUWrite(uint16_t addr, uint8_t data);
 
-    // Rendering
+    // Mapper interface: CHR is addressed through eight 1KB pages and the
+    // name tables through four 1KB pages, updated only on bank switches
+    void MapCHRRom(int firstPage, int count, const uint8_t* data);
+    void MapCHRRam(int firstPage, int count, uint32_t offset);
+    void SetMirroring(Cartridge::Mirror mirror);
+    void SetScanlineCounter(Mapper* mapper);
+
+    // Rendering. RENDER_SCANLINE batches each line and drops to the
+    // dot-accurate path only for lines with mid-line state changes.
+    enum RenderMode {
+        RENDER_DOT,
+        RENDER_SCANLINE
+    };
+    void SetRenderMode(RenderMode mode);
+
     bool FrameReady();
     uint32_t* GetFrameBuffer();
 
+    // Render into caller-owned storage (256x240 ARGB) instead of the
+    // internal buffer, e.g. a TripleBuffer back buffer swapped between
+    // frames. nullptr restores the internal buffer. Only switch buffers at
+    // a frame boundary.
+    void SetFrameBuffer(uint32_t* buffer);
+
+    // OUTPUT_INDEXED renders 6-bit NES color indices (greyscale applied)
+    // plus each line's emphasis bits instead of ARGB, a quarter of the
+    // memory traffic. GetFrameBuffer() still works and converts on demand.
+    // OUTPUT_NONE writes no pixels at all (sprite 0 hits still happen), for
+    // frames that are emulated but never shown; the buffers keep the last
+    // frame that was rendered.
+    enum OutputMode {
+        OUTPUT_ARGB,
+        OUTPUT_INDEXED,
+        OUTPUT_NONE
+    };
+    void SetOutputMode(OutputMode mode);
+    OutputMode GetOutputMode() const;
+    const uint8_t* GetIndexBuffer() const;  // 256x240
+    void SetIndexBuffer(uint8_t* buffer);   // Like SetFrameBuffer
+    const uint8_t* GetLineEmphasis() const; // 240 lines, PPUMASK bits 5-7 >> 5
+    static void ConvertToARGB(const uint8_t* indices, const uint8_t* emphasis, uint32_t* out);
+
+    // Lazy synchronization: the PPU runs behind the CPU and is only caught
+    // up to the connected CPU cycle counter by Sync(), which register
+    // accesses and bank switches call themselves. NextEventDot() is the dot
+    // count at which the CPU must sync to see NMI, a mapper scanline tick
+    // or the end of the frame.
+    void ConnectClock(const uint64_t* cpuCycles);
+    void Sync();
+    uint64_t NextEventDot() const;
+    uint64_t FrameCount() const;
+
+    // Save states: memory, registers and rendering position. Bank and
+    // mirroring pages are restored by the mapper; the frame buffers are not
+    // saved. Call Sync() first.
+    void SaveState(StateWriter& state) const;
+    void LoadState(StateReader& state);
+
+    // Shares the name tables and CHR RAM with child copy-on-write
+    // (NES::Fork); the rest of the state is copied as a forking save state
+    void Fork(PPU& child);
+
     bool nmi;
 
     // OAM for DMA access
@@ -31,9 +94,16 @@ private:
     Cartridge* cartridge;
 
     // PPU Memory
-    uint8_t nameTable[2][1024]; // Two name tables for mirroring
+    SharedPages nameTable;      // Two 1KB name tables for mirroring
     uint8_t palette[32];        // Palette RAM
 
+    // Palette RAM resolved to ARGB with PPUMASK greyscale and emphasis
+    // applied, and to color indices with greyscale applied. Entries 0, 4,
+    // ..., 28 all hold the backdrop color. Updated only by palette writes
+    // and $2001 changes.
+    uint32_t paletteARGB[32];
+    uint8_t paletteIndex[32];
+
     // Internal Registers
     uint16_t vramAddr;    // Current VRAM address (15 bits)
     uint16_t tempAddr;    // Temporary VRAM address
@@ -47,10 +117,23 @@ private:
     uint8_t regStatus;
 
     // Rendering
-    uint32_t frameBuffer[256 * 240];
+    uint32_t* frameBuffer;
+    uint32_t frameStorage[256 * 240];
+    OutputMode outputMode;
+    uint8_t* indexBuffer;
+    uint8_t indexStorage[256 * 240];
+    uint8_t lineEmphasis[240]; // As of each line's first pixel
     int scanline;
     int cycle;
     bool frameComplete;
+    RenderMode renderMode;
+    bool lineDotMode; // Current line runs on the dot path
+
+    // Lazy synchronization
+    const uint64_t* cpuClock;
+    uint64_t dotCount;
+    uint64_t nextEventDot;
+    uint64_t frameCount;
 
     // Background rendering variables
     uint8_t bgNextTileID;
@@ -62,9 +145,17 @@ private:
     uint16_t bgShiftAttribLow;
     uint16_t bgShiftAttribHigh;
 
+    // Sprites for the current line, evaluated at dot 257 of the previous
+    // line and decoded into one entry per pixel (0 = transparent):
+    // bits 0-1 pixel, 2-3 palette, 4 behind background, 5 sprite 0
+    uint8_t spriteLine[256];
+    int spriteCount;
+    bool spriteZeroOnLine;
+
     // Methods
-    uint8_t GetColorFromPaletteRAM(uint8_t paletteNum, uint8_t pixel);
-    void SetPixel(int x, int y, uint8_t color);
+    uint8_t ResolveIndex(uint8_t color) const;
+    void ResolvePaletteEntry(int entry, uint8_t color);
+    void ResolvePalette();
 
     void LoadBackgroundShifters();
     void UpdateShifters();
@@ -77,15 +168,39 @@ private:
 
     void FetchBackgroundData();
 
-    uint8_t chrRam[8192]; // 8KB of CHR RAM
+    SharedPages chrRam; // 8KB of CHR RAM in 1KB pages
+
+    // Write pages are null for CHR ROM and for pages still shared with a
+    // fork; RemapSharedPages() refreshes the pointers into the shared blocks
+    const uint8_t* chrPages[8];  // Pattern table reads
+    uint8_t* chrWritePages[8];
+    const uint8_t* chrDecodedPages[8]; // Decoded rows, 4KB per 1KB page
+    int8_t chrRamBanks[8];       // CHR RAM page in each slot; -1 for CHR ROM
+    const uint8_t* nameTablePages[4]; // $2000/$2400/$2800/$2C00 after mirroring
+    uint8_t* nameTableWritePages[4];
+    uint8_t nameTableBanks[4];
+    Mapper* scanlineCounter;     // Clocked once per rendered scanline
 
     // Helper functions for rendering
     void FetchBackgroundTile();
     void FetchBackgroundTileAttrib();
     void FetchBackgroundTileLsb();
     void FetchBackgroundTileMsb();
+    const uint8_t* DecodedCHRRow(uint16_t addr);
     void RenderPixel();
-
-    // Mirroring helper
-    uint16_t MirrorAddress(uint16_t addr);
+    void EvaluateSprites();
+    uint8_t ComposePixel(int x, uint8_t bgPixel, uint8_t bgPalette);
+    void StepBackground();
+    void RenderScanline();
+    void CatchUp();
+    void UpdateNextEvent();
+    void RemapSharedPages();
+
+    // Kept in step with chrRam by PPUWrite, and shared and unshared with it
+    SharedPages chrRamDecoded;
 };
+
+// Checked by NES::Clock every CPU cycle
+inline uint64_t PPU::NextEventDot() const {
+    return nextEventDot;
+}
@@ -0,0 +1,198 @@
+// Rewind.cpp
+#include "Rewind.h"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include "NES.h"
+
+static size_t RoundUpPow2(size_t n) {
+    size_t size = 1;
+    while (size < n) {
+        size <<= 1;
+    }
+    return size;
+}
+
+static uint8_t* PutVarint(uint8_t* out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+static size_t GetVarint(const uint8_t*& in) {
+    size_t value = 0;
+    int shift = 0;
+    uint8_t byte;
+    do {
+        byte = *in++;
+        value |= (size_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return value;
+}
+
+Rewind::Rewind(NES* nes, size_t capacity, int interval)
+    : nes(nes), interval(interval > 0 ? interval : 1), framesSinceCapture(0),
+      stateSize(nes->StateSize()), current(stateSize), scratch(stateSize),
+      delta(MaxDeltaSize(stateSize)), hasCurrent(false),
+      ring(RoundUpPow2(capacity)), mask(ring.size() - 1), head(0), tail(0), entries(0) {
+}
+
+void Rewind::Capture() {
+    if (++framesSinceCapture < interval) {
+        return;
+    }
+    framesSinceCapture = 0;
+
+    nes->SaveState(scratch.data(), stateSize);
+    if (hasCurrent) {
+        // The delta leads from the new snapshot back to the previous one
+        Push(delta.data(), Encode(scratch.data(), current.data(), stateSize, delta.data()));
+    }
+    std::swap(current, scratch);
+    hasCurrent = true;
+}
+
+bool Rewind::Step() {
+    if (!hasCurrent) {
+        return false;
+    }
+
+    nes->LoadState(current.data(), stateSize);
+    if (entries > 0) {
+        Apply(delta.data(), PopNewest(delta.data()), current.data());
+    }
+    framesSinceCapture = 0;
+    return true;
+}
+
+void Rewind::Clear() {
+    hasCurrent = false;
+    framesSinceCapture = 0;
+    head = tail = 0;
+    entries = 0;
+}
+
+size_t Rewind::Snapshots() const {
+    return hasCurrent ? entries + 1 : 0;
+}
+
+size_t Rewind::BytesUsed() const {
+    return (size_t)(head - tail);
+}
+
+size_t Rewind::Capacity() const {
+    return ring.size();
+}
+
+void Rewind::Push(const uint8_t* data, size_t size) {
+    uint32_t length = (uint32_t)size;
+    size_t needed = size + 2 * sizeof(length);
+    if (needed > ring.size()) {
+        // Cannot be stored: the chain is broken, so older deltas are useless
+        head = tail = 0;
+        entries = 0;
+        return;
+    }
+    while (ring.size() - BytesUsed() < needed) {
+        DropOldest();
+    }
+
+    RingWrite(head, &length, sizeof(length));
+    RingWrite(head + sizeof(length), data, size);
+    RingWrite(head + sizeof(length) + size, &length, sizeof(length));
+    head += needed;
+    entries++;
+}
+
+size_t Rewind::PopNewest(uint8_t* data) {
+    uint32_t length;
+    RingRead(head - sizeof(length), &length, sizeof(length));
+    head -= length + 2 * sizeof(length);
+    RingRead(head + sizeof(length), data, length);
+    entries--;
+    return length;
+}
+
+void Rewind::DropOldest() {
+    uint32_t length;
+    RingRead(tail, &length, sizeof(length));
+    tail += length + 2 * sizeof(length);
+    entries--;
+}
+
+void Rewind::RingWrite(uint64_t pos, const void* data, size_t size) {
+    size_t offset = (size_t)(pos & mask);
+    size_t first = std::min(size, ring.size() - offset);
+    std::memcpy(&ring[offset], data, first);
+    std::memcpy(&ring[0], static_cast<const uint8_t*>(data) + first, size - first);
+}
+
+void Rewind::RingRead(uint64_t pos, void* data, size_t size) const {
+    size_t offset = (size_t)(pos & mask);
+    size_t first = std::min(size, ring.size() - offset);
+    std::memcpy(data, &ring[offset], first);
+    std::memcpy(static_cast<uint8_t*>(data) + first, &ring[0], size - first);
+}
+
+// Worst case: every token carries two 5-byte varints and at least
+// MIN_ZERO_RUN + 1 bytes of input
+size_t Rewind::MaxDeltaSize(size_t stateSize) {
+    return stateSize + 10 * (stateSize / (MIN_ZERO_RUN + 1) + 1);
+}
+
+// Run-length codes a XOR b as tokens of [zero run][literal length][literal
+// bytes], lengths as LEB128 varints. Equal regions are skipped a word at a
+// time; they are most of the state.
+size_t Rewind::Encode(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out) {
+    uint8_t* start = out;
+    size_t pos = 0;
+    while (pos < size) {
+        size_t zeroStart = pos;
+        while (pos + 8 <= size) {
+            uint64_t wordA, wordB;
+            std::memcpy(&wordA, a + pos, 8);
+            std::memcpy(&wordB, b + pos, 8);
+            if (wordA != wordB) {
+                break;
+            }
+            pos += 8;
+        }
+        while (pos < size && a[pos] == b[pos]) {
+            pos++;
+        }
+
+        // The literal ends where the next long enough zero run starts
+        size_t literalStart = pos;
+        size_t equal = 0;
+        while (pos < size && equal < MIN_ZERO_RUN) {
+            equal = (a[pos] == b[pos]) ? equal + 1 : 0;
+            pos++;
+        }
+        pos -= equal;
+
+        out = PutVarint(out, literalStart - zeroStart);
+        out = PutVarint(out, pos - literalStart);
+        for (size_t i = literalStart; i < pos; i++) {
+            *out++ = a[i] ^ b[i];
+        }
+    }
+    return (size_t)(out - start);
+}
+
+void Rewind::Apply(const uint8_t* delta, size_t size, uint8_t* state) {
+    const uint8_t* end = delta + size;
+    size_t pos = 0;
+    while (delta < end) {
+        pos += GetVarint(delta);
+        size_t count = GetVarint(delta);
+        for (size_t i = 0; i < count; i++) {
+            state[pos + i] ^= delta[i];
+        }
+        delta += count;
+        pos += count;
+    }
+}
@@ -0,0 +1,71 @@
+// Rewind.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class NES;
+
+// Rewind history: a save state every `interval` frames, kept as a chain of
+// compressed XOR deltas in a fixed-size byte ring. Only the newest
+// snapshot is held in full; each ring entry turns a snapshot into the one
+// before it, so stepping back decodes one delta and loads the result.
+// When the ring is full the oldest entries are discarded. Consecutive
+// states differ in a few hundred bytes, so a delta is a small fraction of
+// the full state.
+class Rewind {
+public:
+    // capacity (delta bytes) is rounded up to a power of two
+    Rewind(NES* nes, size_t capacity, int interval = 1);
+
+    // Call once per emulated frame; snapshots every interval frames
+    void Capture();
+
+    // Loads the newest snapshot and drops it from the history, so repeated
+    // calls walk backwards interval frames at a time. The oldest snapshot
+    // is kept and reloaded once the history is exhausted. Returns false if
+    // nothing has been captured.
+    bool Step();
+
+    void Clear();
+
+    size_t Snapshots() const;  // Including the newest, full snapshot
+    size_t BytesUsed() const;  // Delta bytes in the ring
+    size_t Capacity() const;
+
+    // The delta codec. Encode writes a ^ b as zero runs and literals into
+    // out, which must hold MaxDeltaSize(size) bytes, and returns the bytes
+    // written; Apply XORs a delta into a state, so applying it to either
+    // input yields the other.
+    static size_t MaxDeltaSize(size_t stateSize);
+    static size_t Encode(const uint8_t* a, const uint8_t* b, size_t size, uint8_t* out);
+    static void Apply(const uint8_t* delta, size_t size, uint8_t* state);
+
+private:
+    // Zero runs shorter than this are folded into the surrounding literal
+    static const size_t MIN_ZERO_RUN = 8;
+
+    NES* nes;
+    int interval;
+    int framesSinceCapture;
+
+    size_t stateSize;
+    std::vector<uint8_t> current; // Newest snapshot
+    std::vector<uint8_t> scratch; // Snapshot being captured
+    std::vector<uint8_t> delta;   // Encoded delta being stored or applied
+    bool hasCurrent;
+
+    // Entries are [u32 size][delta][u32 size] so they can be removed from
+    // either end. Positions increase monotonically and are masked on access.
+    std::vector<uint8_t> ring;
+    size_t mask;
+    uint64_t head;
+    uint64_t tail;
+    size_t entries;
+
+    void Push(const uint8_t* data, size_t size);
+    size_t PopNewest(uint8_t* data);
+    void DropOldest();
+    void RingWrite(uint64_t pos, const void* data, size_t size);
+    void RingRead(uint64_t pos, void* data, size_t size) const;
+};
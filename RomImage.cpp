@@ -0,0 +1,220 @@
+// RomImage.cpp
+#include "RomImage.h"
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include "Cartridge.h"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Process-wide cache: content hash to every live image with that hash
+// (more than one only on a hash collision)
+static std::mutex cacheMutex;
+static std::unordered_multimap<uint64_t, std::weak_ptr<const RomImage>> cache;
+
+RomImage::RomImage()
+    : data(nullptr), size(0), mapping(nullptr), mappedSize(0), prgOffset(0), prgSize(0), chrSize(0), hash(0) {}
+
+RomImage::~RomImage() {
+    Unmap();
+}
+
+std::shared_ptr<const RomImage> RomImage::Load(const std::string& filename) {
+    std::shared_ptr<RomImage> image(new RomImage());
+    if (!image->MapFile(filename) && !image->ReadFile(filename, 0)) {
+        std::cout << "Could not open ROM file: " << filename << std::endl;
+        return nullptr;
+    }
+
+    // Verify NES file format
+    const uint8_t* header = image->data;
+    if (image->size < 16 || header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 0x1A) {
+        std::cout << "Invalid NES ROM file." << std::endl;
+        return nullptr;
+    }
+
+    // PRG ROM follows the header and the trainer, if present; CHR ROM
+    // follows PRG ROM
+    image->prgOffset = 16 + ((header[6] & 0x04) ? 512 : 0);
+    image->prgSize = header[4] * 16384;
+    image->chrSize = header[5] * 8192;
+    if (image->prgSize == 0) {
+        std::cout << "Invalid NES ROM file: no PRG ROM." << std::endl;
+        return nullptr;
+    }
+
+    // A truncated file reads as zeros past its end rather than faulting
+    size_t needed = image->prgOffset + image->prgSize + image->chrSize;
+    if (image->size < needed) {
+        image->Unmap();
+        if (!image->ReadFile(filename, needed)) {
+            return nullptr;
+        }
+    }
+
+    const uint8_t* rom = image->data + image->prgOffset;
+    size_t romSize = image->prgSize + image->chrSize;
+    image->hash = 0xCBF29CE484222325ULL;
+    for (size_t i = 0; i < romSize; i++) {
+        image->hash = (image->hash ^ rom[i]) * 0x100000001B3ULL;
+    }
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    auto range = cache.equal_range(image->hash);
+    for (auto it = range.first; it != range.second;) {
+        std::shared_ptr<const RomImage> cached = it->second.lock();
+        if (!cached) {
+            it = cache.erase(it);
+            continue;
+        }
+        if (cached->prgSize == image->prgSize && cached->chrSize == image->chrSize &&
+            std::memcmp(cached->Header(), image->Header(), 16) == 0 &&
+            std::memcmp(cached->PRG(), rom, romSize) == 0) {
+            return cached; // Our mapping is released with image
+        }
+        ++it;
+    }
+
+    // Decode every tile once so the PPU never has to mux bit planes
+    const uint8_t* chr = image->CHR();
+    image->chrDecoded.resize(image->chrSize * 4);
+    for (size_t tile = 0; tile < image->chrSize; tile += 16) {
+        for (int row = 0; row < 8; row++) {
+            Cartridge::DecodeCHRRow(chr[tile + row], chr[tile + row + 8], &image->chrDecoded[tile * 4 + row * 8]);
+        }
+    }
+
+    cache.emplace(image->hash, image);
+    return image;
+}
+
+size_t RomImage::CachedImages() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    size_t count = 0;
+    for (const auto& entry : cache) {
+        if (!entry.second.expired()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+const uint8_t* RomImage::Header() const {
+    return data;
+}
+
+const uint8_t* RomImage::PRG() const {
+    return data + prgOffset;
+}
+
+size_t RomImage::PRGSize() const {
+    return prgSize;
+}
+
+const uint8_t* RomImage::CHR() const {
+    return data + prgOffset + prgSize;
+}
+
+size_t RomImage::CHRSize() const {
+    return chrSize;
+}
+
+const uint8_t* RomImage::CHRDecoded() const {
+    return chrDecoded.data();
+}
+
+uint64_t RomImage::Hash() const {
+    return hash;
+}
+
+bool RomImage::Mapped() const {
+    return mapping != nullptr;
+}
+
+// Maps the whole file read-only. Pages come from the OS file cache, so
+// every process and instance mapping the file shares them.
+bool RomImage::MapFile(const std::string& filename) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    HANDLE section = nullptr;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+        section = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    CloseHandle(file);
+    if (!section) {
+        return false;
+    }
+    void* view = MapViewOfFile(section, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(section); // The view keeps the mapping alive
+    if (!view) {
+        return false;
+    }
+    mappedSize = (size_t)fileSize.QuadPart;
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    void* view = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // The mapping stays valid
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    mappedSize = (size_t)info.st_size;
+#endif
+    mapping = view;
+    data = static_cast<const uint8_t*>(view);
+    size = mappedSize;
+    return true;
+}
+
+// Fallback: reads the file into memory, zero-padded to minimumSize
+bool RomImage::ReadFile(const std::string& filename, size_t minimumSize) {
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (buffer.size() < minimumSize) {
+        buffer.resize(minimumSize, 0);
+    }
+    data = buffer.data();
+    size = buffer.size();
+    return true;
+}
+
+void RomImage::Unmap() {
+    if (!mapping) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(mapping);
+#else
+    munmap(mapping, mappedSize);
+#endif
+    mapping = nullptr;
+    data = nullptr;
+    size = 0;
+}
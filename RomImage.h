@@ -0,0 +1,56 @@
+// RomImage.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// The read-only part of a cartridge: an iNES file mapped into memory, with
+// PRG ROM and CHR ROM used in place and CHR ROM also decoded for the PPU.
+// Images are cached process-wide by content hash, so every Cartridge
+// loaded from the same ROM shares one mapping and one decoded copy; PRG
+// RAM and CHR RAM stay per instance. An image lives as long as a
+// cartridge uses it.
+class RomImage {
+public:
+    ~RomImage();
+
+    // Returns the image for filename's contents, reusing a live image with
+    // the same contents when there is one. Null if the file cannot be read
+    // or is not an iNES file.
+    static std::shared_ptr<const RomImage> Load(const std::string& filename);
+
+    // Live images in the process-wide cache
+    static size_t CachedImages();
+
+    const uint8_t* Header() const; // 16-byte iNES header
+    const uint8_t* PRG() const;
+    size_t PRGSize() const;
+    const uint8_t* CHR() const;
+    size_t CHRSize() const;        // 0 when the board uses CHR RAM
+    const uint8_t* CHRDecoded() const; // CHR ROM as decoded rows, 64 bytes per tile
+
+    uint64_t Hash() const;  // FNV-1a of PRG ROM then CHR ROM
+    bool Mapped() const;    // False if the file had to be read into memory
+
+private:
+    RomImage();
+
+    // The whole file, either mapped or in buffer
+    const uint8_t* data;
+    size_t size;
+    std::vector<uint8_t> buffer;
+    void* mapping;       // Start of the mapped view; null when buffered
+    size_t mappedSize;
+
+    size_t prgOffset;
+    size_t prgSize;
+    size_t chrSize;
+    std::vector<uint8_t> chrDecoded;
+    uint64_t hash;
+
+    bool MapFile(const std::string& filename);
+    bool ReadFile(const std::string& filename, size_t minimumSize);
+    void Unmap();
+};
@@ -0,0 +1,59 @@
+// RunAhead.cpp
+#include "RunAhead.h"
+#include "NES.h"
+
+RunAhead::RunAhead(NES* nes, NES* shadow) : nes(nes), shadow(shadow), frames(0), state(nes->StateSize()) {
+    if (shadow) {
+        // Look-ahead audio is never heard
+        shadow->apu.SetSampleRate(0);
+    }
+}
+
+void RunAhead::SetFrames(int frames) {
+    this->frames = frames > 0 ? frames : 0;
+}
+
+int RunAhead::Frames() const {
+    return frames;
+}
+
+NES* RunAhead::Display() const {
+    return (shadow && frames > 0) ? shadow : nes;
+}
+
+void RunAhead::RunFrame(uint8_t buttons) {
+    nes->controller1.SetButtonStates(buttons);
+    if (frames == 0) {
+        nes->RunFrame();
+        return;
+    }
+
+    // The real frame is never shown
+    PPU::OutputMode mode = nes->ppu.GetOutputMode();
+    nes->ppu.SetOutputMode(PPU::OUTPUT_NONE);
+    nes->RunFrame();
+    nes->ppu.SetOutputMode(mode);
+    nes->SaveState(state.data(), state.size());
+
+    if (shadow) {
+        // The state includes the held buttons
+        shadow->LoadState(state.data(), state.size());
+        RunAheadFrames(shadow);
+    }
+    else {
+        nes->apu.SuspendOutput();
+        RunAheadFrames(nes);
+        nes->LoadState(state.data(), state.size());
+        nes->apu.ResumeOutput();
+    }
+}
+
+void RunAhead::RunAheadFrames(NES* core) {
+    PPU::OutputMode mode = core->ppu.GetOutputMode();
+    core->ppu.SetOutputMode(PPU::OUTPUT_NONE);
+    for (int i = 1; i < frames; i++) {
+        core->RunFrame();
+    }
+    core->ppu.SetOutputMode(mode);
+    core->RunFrame();
+}
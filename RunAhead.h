@@ -0,0 +1,39 @@
+// RunAhead.h
+#pragma once
+#include <cstdint>
+#include <vector>
+
+class NES;
+
+// Run-ahead input latency reduction. Games usually act on input a frame or
+// more after reading it; run-ahead emulates each frame for real, then
+// Frames() more with the same input, and shows the last of those. Only
+// that frame is rendered.
+//
+// With one core, the look-ahead runs between a SaveState and a LoadState,
+// with audio suspended so it continues from the real frame untouched. With
+// a shadow core (a second NES on the same ROM) the look-ahead runs there,
+// loaded from the primary every frame, and the primary is never rolled
+// back: anything watching it (audio, rewind, traces) sees only real frames.
+class RunAhead {
+public:
+    explicit RunAhead(NES* nes, NES* shadow = nullptr);
+
+    void SetFrames(int frames); // 0 disables run-ahead
+    int Frames() const;
+
+    // Emulates one frame with the given buttons held (bit n = button n)
+    void RunFrame(uint8_t buttons);
+
+    // The core whose PPU renders the frame to show; set its frame buffer
+    // and output mode
+    NES* Display() const;
+
+private:
+    NES* nes;
+    NES* shadow;
+    int frames;
+    std::vector<uint8_t> state;
+
+    void RunAheadFrames(NES* core);
+};
@@ -0,0 +1,111 @@
+// SaveState.h
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Save state layout: SaveStateHeader followed by each component's state in
+// a fixed order (NES::SaveState). Fields are stored one by one in host
+// byte order (little-endian on every supported target), never as raw
+// structs, so padding and member order do not leak into the format. The
+// same bytes are used in memory and on disk.
+struct SaveStateHeader {
+    char     magic[8];  // "NESSTATE"
+    uint32_t version;
+    uint32_t size;      // Total size including this header
+    uint64_t romHash;   // Cartridge::romHash of the ROM the state belongs to
+};
+
+static const uint32_t SAVE_STATE_VERSION = 1;
+
+// Sequential writer over a caller-provided buffer. Never allocates; with a
+// null buffer it only measures. Writing past the end sets Overflowed() and
+// stops storing, but Size() keeps counting.
+//
+// A forking writer produces the state NES::Fork copies into a child:
+// components leave out the blocks the child shares copy-on-write instead
+// (SharedPages). Such a state is only for a matching forking reader.
+class StateWriter {
+public:
+    StateWriter(uint8_t* buffer, size_t capacity, bool forking = false)
+        : buffer(buffer), capacity(capacity), pos(0), forking(forking) {}
+
+    template <typename T>
+    void Write(const T& value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "State fields are scalars");
+        WriteBytes(&value, sizeof(T));
+    }
+
+    void WriteBytes(const void* data, size_t size) {
+        if (buffer && pos + size <= capacity) {
+            std::memcpy(buffer + pos, data, size);
+        }
+        pos += size;
+    }
+
+    size_t Size() const { return pos; }
+    bool Overflowed() const { return pos > capacity; }
+    bool Forking() const { return forking; }
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t pos;
+    bool forking;
+};
+
+// Sequential reader. Reading past the end zero-fills and sets Failed(), as
+// does a bool that is not 0 or 1 or a ReadRange() field out of its range,
+// so a corrupt state never puts a value out of range into a component.
+class StateReader {
+public:
+    StateReader(const uint8_t* buffer, size_t size, bool forking = false)
+        : buffer(buffer), size(size), pos(0), failed(false), forking(forking) {}
+
+    template <typename T>
+    void Read(T& value) {
+        static_assert(std::is_arithmetic<T>::value || std::is_enum<T>::value, "State fields are scalars");
+        if constexpr (std::is_same<T, bool>::value) {
+            uint8_t byte;
+            ReadBytes(&byte, 1);
+            failed |= byte > 1;
+            value = byte == 1;
+        }
+        else {
+            ReadBytes(&value, sizeof(T));
+        }
+    }
+
+    // For fields used as indices or shift counts: a value outside
+    // [low, high] fails the state and reads as low
+    template <typename T>
+    void ReadRange(T& value, T low, T high) {
+        Read(value);
+        if (value < low || value > high) {
+            value = low;
+            failed = true;
+        }
+    }
+
+    void ReadBytes(void* data, size_t count) {
+        if (pos + count > size) {
+            std::memset(data, 0, count);
+            failed = true;
+            return;
+        }
+        std::memcpy(data, buffer + pos, count);
+        pos += count;
+    }
+
+    size_t Position() const { return pos; }
+    bool Failed() const { return failed; }
+    bool Forking() const { return forking; }
+
+private:
+    const uint8_t* buffer;
+    size_t size;
+    size_t pos;
+    bool failed;
+    bool forking;
+};
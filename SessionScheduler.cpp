@@ -0,0 +1,185 @@
+// SessionScheduler.cpp
+#include "SessionScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include "NES.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#elif defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// Failed steal rounds before an idle worker starts sleeping between tries
+static const int IDLE_SPINS = 64;
+static const std::chrono::microseconds IDLE_SLEEP(50);
+
+SessionScheduler::SessionScheduler(const Config& config) : config(config), remaining(0) {
+    threads = config.threads > 0 ? config.threads : (int)std::thread::hardware_concurrency();
+    threads = std::max(threads, 1);
+    this->config.framesPerSlice = std::max(config.framesPerSlice, 1);
+    queues.reset(new Queue[threads]);
+}
+
+SessionScheduler::~SessionScheduler() {}
+
+int SessionScheduler::Add(const Cartridge& rom, uint64_t frameBudget) {
+    // A core for an unloaded cartridge would only sit halted
+    if (!rom.Loaded()) {
+        return -1;
+    }
+    std::unique_ptr<Session> session(new Session());
+    session->cartridge.reset(new Cartridge(rom));
+    session->budget = frameBudget;
+    sessions.push_back(std::move(session));
+    return (int)sessions.size() - 1;
+}
+
+void SessionScheduler::Run() {
+    // Spread the unfinished sessions over the workers; each keeps its home
+    // until it is stolen
+    int count = 0;
+    for (int id = 0; id < (int)sessions.size(); id++) {
+        const Session& session = *sessions[id];
+        if (!session.nes || (session.stats.frames < session.budget && session.nes->Running())) {
+            queues[count++ % threads].sessions.push_back(id);
+        }
+    }
+    remaining.store(count, std::memory_order_relaxed);
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(&SessionScheduler::Worker, this, i);
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+int SessionScheduler::Sessions() const {
+    return (int)sessions.size();
+}
+
+int SessionScheduler::Threads() const {
+    return threads;
+}
+
+NES* SessionScheduler::Core(int id) {
+    return sessions[id]->nes.get();
+}
+
+const SessionScheduler::SessionStats& SessionScheduler::Stats(int id) const {
+    return sessions[id]->stats;
+}
+
+void SessionScheduler::Worker(int index) {
+    if (config.pinThreads) {
+        PinThread(index);
+    }
+
+    uint32_t random = 0x9E3779B9u * (index + 1);
+    int idle = 0;
+    while (remaining.load(std::memory_order_acquire) > 0) {
+        int id;
+        bool found = Take(index, id);
+
+        // Out of work: try the other queues, starting at a random one so
+        // thieves spread out
+        if (!found && threads > 1) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            int start = (int)(random % threads);
+            for (int i = 0; i < threads && !found; i++) {
+                int victim = (start + i) % threads;
+                if (victim != index && Take(victim, id)) {
+                    found = true;
+                    sessions[id]->stats.migrations++;
+                }
+            }
+        }
+
+        if (!found) {
+            if (++idle < IDLE_SPINS) {
+                std::this_thread::yield();
+            }
+            else {
+                std::this_thread::sleep_for(IDLE_SLEEP);
+            }
+            continue;
+        }
+        idle = 0;
+
+        if (RunSlice(index, id)) {
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+        else {
+            Give(index, id);
+        }
+    }
+}
+
+bool SessionScheduler::Take(int queue, int& id) {
+    Queue& q = queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.sessions.empty()) {
+        return false;
+    }
+    id = q.sessions.front();
+    q.sessions.pop_front();
+    return true;
+}
+
+void SessionScheduler::Give(int queue, int id) {
+    Queue& q = queues[queue];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    q.sessions.push_back(id);
+}
+
+// Runs up to framesPerSlice frames; returns true once the session is done
+bool SessionScheduler::RunSlice(int worker, int id) {
+    Session& session = *sessions[id];
+    if (!session.nes) {
+        // Built by the worker that runs it, so first touch places its
+        // memory near this CPU
+        session.nes.reset(new NES(session.cartridge.get()));
+        session.nes->apu.SetSampleRate(0);
+        session.nes->Reset();
+    }
+
+    NES& nes = *session.nes;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < config.framesPerSlice && session.stats.frames < session.budget && nes.Running(); i++) {
+        nes.RunFrame();
+        session.stats.frames++;
+    }
+    session.stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    session.stats.worker = worker;
+
+    if (!nes.Running() && session.stats.frames < session.budget) {
+        session.stats.halted = true;
+        return true;
+    }
+    return session.stats.frames >= session.budget;
+}
+
+void SessionScheduler::PinThread(int cpu) {
+    unsigned int cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu %= cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#elif defined(_WIN32)
+    if (cpu < 64) {
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+    }
+#else
+    (void)cpu;
+#endif
+}
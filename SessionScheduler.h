@@ -0,0 +1,80 @@
+// SessionScheduler.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Cartridge.h"
+
+class NES;
+
+// Runs many independent emulator sessions (a regression farm) on a
+// work-stealing pool. Each worker thread is pinned to one CPU and keeps its
+// own queue of sessions, running them in turn a slice of frames at a time
+// and yielding at frame boundaries. A session goes back to the queue of
+// the worker that ran it, so its state stays in that core's caches, and
+// its core is built by the first worker to run it, so the memory is
+// local to that CPU. Only a worker that runs out of sessions takes one
+// from another's queue. Workers share nothing else while running.
+class SessionScheduler {
+public:
+    struct Config {
+        int threads = 0;        // Worker threads; 0 = one per hardware thread
+        int framesPerSlice = 1; // Frames a session runs before yielding its worker
+        bool pinThreads = true; // Pin worker i to CPU i
+    };
+
+    struct SessionStats {
+        uint64_t frames = 0;     // Frames run so far
+        bool halted = false;     // CPU stopped before the budget was used up
+        double seconds = 0.0;    // Time spent running the session
+        int worker = -1;         // Worker that last ran it
+        uint32_t migrations = 0; // Times another worker took it over
+    };
+
+    explicit SessionScheduler(const Config& config);
+    ~SessionScheduler();
+
+    // Adds a session running its own copy of rom (sharing the ROM image)
+    // for frameBudget frames, or until its CPU halts. Audio synthesis is
+    // off. Returns the session id, or -1 if rom is not loaded (Load()
+    // failed or was never called).
+    int Add(const Cartridge& rom, uint64_t frameBudget);
+
+    // Runs every unfinished session to the end of its budget; blocks
+    void Run();
+
+    int Sessions() const;
+    int Threads() const;
+    NES* Core(int id); // Null until the session first runs
+    const SessionStats& Stats(int id) const;
+
+private:
+    struct Session {
+        std::unique_ptr<Cartridge> cartridge;
+        std::unique_ptr<NES> nes;
+        uint64_t budget;
+        SessionStats stats;
+    };
+
+    // Owner and thieves both take from the front; sessions that yield go
+    // to the back, so a worker's own sessions take turns
+    struct alignas(64) Queue {
+        std::mutex mutex;
+        std::deque<int> sessions;
+    };
+
+    Config config;
+    int threads;
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::unique_ptr<Queue[]> queues;
+    alignas(64) std::atomic<int> remaining;
+
+    void Worker(int index);
+    bool Take(int queue, int& id);
+    void Give(int queue, int id);
+    bool RunSlice(int worker, int id);
+    static void PinThread(int cpu);
+};
@@ -0,0 +1,81 @@
+// SharedPages.cpp
+#include "SharedPages.h"
+#include <cassert>
+#include <cstring>
+#include <new>
+
+SharedPages::SharedPages(size_t pageSize, int pageCount)
+    : pageSize(pageSize), pageCount(pageCount < MAX_PAGES ? pageCount : MAX_PAGES), shared(0) {
+    // blocks[] and the shared mask hold MAX_PAGES; past that, assert in
+    // debug builds and keep to the first MAX_PAGES pages in release
+    assert(pageCount <= MAX_PAGES);
+    for (int i = 0; i < this->pageCount; i++) {
+        blocks[i] = Allocate();
+        std::memset(blocks[i]->Data(), 0, pageSize);
+    }
+}
+
+SharedPages::~SharedPages() {
+    for (int i = 0; i < pageCount; i++) {
+        Release(blocks[i]);
+    }
+}
+
+size_t SharedPages::PageSize() const {
+    return pageSize;
+}
+
+int SharedPages::PageCount() const {
+    return pageCount;
+}
+
+int SharedPages::Owners(int index) const {
+    return blocks[index]->refs.load(std::memory_order_acquire);
+}
+
+void SharedPages::Fork(SharedPages& child) {
+    for (int i = 0; i < pageCount; i++) {
+        blocks[i]->refs.fetch_add(1, std::memory_order_relaxed);
+        Release(child.blocks[i]);
+        child.blocks[i] = blocks[i];
+    }
+    shared = child.shared = (pageCount < 32) ? (1u << pageCount) - 1 : ~0u;
+}
+
+void SharedPages::Clear() {
+    for (int i = 0; i < pageCount; i++) {
+        if (Shared(i) && blocks[i]->refs.load(std::memory_order_acquire) > 1) {
+            Release(blocks[i]);
+            blocks[i] = Allocate();
+        }
+        std::memset(blocks[i]->Data(), 0, pageSize);
+    }
+    shared = 0;
+}
+
+SharedPages::Block* SharedPages::Allocate() {
+    void* memory = ::operator new(sizeof(Block) + pageSize);
+    Block* block = new (memory) Block;
+    block->refs.store(1, std::memory_order_relaxed);
+    return block;
+}
+
+void SharedPages::Release(Block* block) {
+    // The last owner frees the page, after every other owner's last access
+    if (block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block->~Block();
+        ::operator delete(block);
+    }
+}
+
+void SharedPages::Unshare(int index) {
+    // Once the others have let go the page is ours and needs no copy
+    Block* block = blocks[index];
+    if (block->refs.load(std::memory_order_acquire) > 1) {
+        Block* copy = Allocate();
+        std::memcpy(copy->Data(), block->Data(), pageSize);
+        Release(block);
+        blocks[index] = copy;
+    }
+    shared &= ~(1u << index);
+}
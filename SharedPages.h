@@ -0,0 +1,74 @@
+// SharedPages.h
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// A block of emulated memory split into fixed-size pages that forked
+// machines share copy-on-write (NES::Fork). Fork() points another block at
+// the same pages; after that, the first Writable() call for a page on
+// either side gives that side a private copy, so forks only pay for the
+// pages they dirty. Page reference counts are atomic, so machines sharing
+// pages may run on different threads.
+//
+// Page pointers change when a page is unshared or cleared; owners cache
+// them in their page tables and refresh them after those calls.
+class SharedPages {
+public:
+    static const int MAX_PAGES = 32;
+
+    SharedPages(size_t pageSize, int pageCount); // Private, zeroed pages; pageCount <= MAX_PAGES
+    ~SharedPages();
+    SharedPages(const SharedPages&) = delete;
+    SharedPages& operator=(const SharedPages&) = delete;
+
+    size_t PageSize() const;
+    int PageCount() const;
+
+    const uint8_t* Page(int index) const;
+
+    // True while the page may still be shared, i.e. Writable() may copy
+    bool Shared(int index) const;
+
+    // Blocks currently holding the page, 1 once it is private
+    int Owners(int index) const;
+
+    // The page for writing, copied first if another block shares it
+    uint8_t* Writable(int index);
+
+    // Makes child (same geometry) share every page of this block
+    void Fork(SharedPages& child);
+
+    // Zeroes every page; shared pages are replaced rather than copied
+    void Clear();
+
+private:
+    struct alignas(16) Block {
+        std::atomic<int> refs;
+        uint8_t* Data() { return reinterpret_cast<uint8_t*>(this + 1); }
+    };
+
+    size_t pageSize;
+    int pageCount;
+    uint32_t shared; // Bit per page: Writable() must check the count
+    Block* blocks[MAX_PAGES];
+
+    Block* Allocate();
+    static void Release(Block* block);
+    void Unshare(int index);
+};
+
+inline const uint8_t* SharedPages::Page(int index) const {
+    return blocks[index]->Data();
+}
+
+inline bool SharedPages::Shared(int index) const {
+    return (shared >> index) & 1;
+}
+
+inline uint8_t* SharedPages::Writable(int index) {
+    if (Shared(index)) {
+        Unshare(index);
+    }
+    return blocks[index]->Data();
+}
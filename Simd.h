@@ -0,0 +1,26 @@
+// Simd.h
+#pragma once
+
+// Instruction set selection for the vector paths in the PPU and cartridge.
+// Every vector path has a scalar fallback. Which one is compiled follows
+// the compiler's target flags (see NES_SIMD in CMakeLists.txt); building
+// with NES_SIMD=0 forces the scalar code everywhere.
+#ifndef NES_SIMD
+#define NES_SIMD 1
+#endif
+
+#if NES_SIMD && (defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86))
+#include <immintrin.h>
+
+#if defined(__AVX2__)
+#define NES_SIMD_AVX2 1
+#endif
+
+#if defined(__SSSE3__) || defined(__AVX2__)
+#define NES_SIMD_SSSE3 1
+#endif
+
+#if defined(__BMI2__)
+#define NES_SIMD_BMI2 1
+#endif
+#endif
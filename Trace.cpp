@@ -0,0 +1,80 @@
+// Trace.cpp
+#include "Trace.h"
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+TraceWriter::TraceWriter()
+    : ring(new TraceRecord[CAPACITY]), head(0), tail(0), active(false), file(nullptr) {}
+
+TraceWriter::~TraceWriter() {
+    Close();
+}
+
+bool TraceWriter::Open(const std::string& filename) {
+    Close();
+
+    file = std::fopen(filename.c_str(), "wb");
+    if (!file) {
+        std::cout << "Could not open trace file: " << filename << std::endl;
+        return false;
+    }
+
+    TraceFileHeader header;
+    std::memcpy(header.magic, "NESTRACE", 8);
+    header.version = TRACE_FILE_VERSION;
+    header.recordSize = sizeof(TraceRecord);
+    std::fwrite(&header, sizeof(header), 1, file);
+
+    head.store(0);
+    tail.store(0);
+    active.store(true);
+    worker = std::thread(&TraceWriter::Drain, this);
+    return true;
+}
+
+void TraceWriter::Close() {
+    if (!file) return;
+
+    active.store(false);
+    worker.join();
+    std::fclose(file);
+    file = nullptr;
+}
+
+bool TraceWriter::IsOpen() const {
+    return file != nullptr;
+}
+
+uint64_t TraceWriter::RecordsWritten() const {
+    return tail.load(std::memory_order_acquire);
+}
+
+void TraceWriter::Drain() {
+    for (;;) {
+        // Read the flag before head so a final batch pushed before Close()
+        // is always flushed
+        bool stillActive = active.load(std::memory_order_acquire);
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        uint64_t h = head.load(std::memory_order_acquire);
+
+        if (h == t) {
+            if (!stillActive) break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        // Write the contiguous run up to the end of the ring, then wrap
+        while (t != h) {
+            size_t start = t & (CAPACITY - 1);
+            size_t count = (size_t)(h - t);
+            if (start + count > CAPACITY) {
+                count = CAPACITY - start;
+            }
+            std::fwrite(&ring[start], sizeof(TraceRecord), count, file);
+            t += count;
+        }
+        tail.store(t, std::memory_order_release);
+    }
+    std::fflush(file);
+}
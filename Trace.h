@@ -0,0 +1,78 @@
+// Trace.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+// Instruction tracing is compiled out of CPU::ExecuteInstruction unless the
+// build defines NES_TRACE=1 (CMake option NES_ENABLE_TRACE).
+#ifndef NES_TRACE
+#define NES_TRACE 0
+#endif
+
+// One executed instruction, captured after the opcode fetch and before the
+// instruction runs, so the registers are the ones it starts with.
+struct TraceRecord {
+    uint64_t cycle;      // CPU cycle count at the opcode fetch
+    uint16_t pc;         // Address of the opcode
+    uint8_t  opcode;
+    uint8_t  operand[2]; // The two bytes after the opcode
+    uint8_t  a;
+    uint8_t  x;
+    uint8_t  y;
+    uint8_t  sp;
+    uint8_t  p;
+    uint8_t  reserved[6];
+};
+static_assert(sizeof(TraceRecord) == 24, "TraceRecord is part of the on-disk format");
+
+// Trace file layout: TraceFileHeader followed by packed TraceRecords
+struct TraceFileHeader {
+    char     magic[8];   // "NESTRACE"
+    uint32_t version;
+    uint32_t recordSize;
+};
+
+static const uint32_t TRACE_FILE_VERSION = 1;
+
+// Single-producer/single-consumer ring of TraceRecords. The emulation thread
+// pushes, a background thread drains the ring to a file.
+class TraceWriter {
+public:
+    TraceWriter();
+    ~TraceWriter();
+
+    bool Open(const std::string& filename);
+    void Close();
+    bool IsOpen() const;
+
+    // Called from the emulation thread only. Waits if the ring is full so
+    // that no records are lost.
+    void Push(const TraceRecord& record);
+
+    uint64_t RecordsWritten() const;
+
+private:
+    static const size_t CAPACITY = 1 << 16; // Records, power of two
+
+    void Drain();
+
+    std::unique_ptr<TraceRecord[]> ring;
+    alignas(64) std::atomic<uint64_t> head; // Next slot to write (producer)
+    alignas(64) std::atomic<uint64_t> tail; // Next slot to flush (consumer)
+    std::atomic<bool> active;
+    std::thread worker;
+    FILE* file;
+};
+
+inline void TraceWriter::Push(const TraceRecord& record) {
+    uint64_t h = head.load(std::memory_order_relaxed);
+    while (h - tail.load(std::memory_order_acquire) >= CAPACITY) {
+        std::this_thread::yield();
+    }
+    ring[h & (CAPACITY - 1)] = record;
+    head.store(h + 1, std::memory_order_release);
+}
@@ -0,0 +1,35 @@
+// TripleBuffer.cpp
+#include "TripleBuffer.h"
+
+TripleBuffer::TripleBuffer()
+    : storage(3 * FRAME_PIXELS, 0), middle(1), writeIndex(0), readIndex(2), dropped(0) {
+}
+
+uint32_t* TripleBuffer::WriteBuffer() {
+    return &storage[writeIndex * FRAME_PIXELS];
+}
+
+void TripleBuffer::Publish() {
+    // Release makes the frame's pixels visible to the consumer's acquire
+    uint8_t previous = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+    writeIndex = previous & 3;
+    if (previous & FRESH) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+uint64_t TripleBuffer::Dropped() const {
+    return dropped.load(std::memory_order_relaxed);
+}
+
+bool TripleBuffer::Acquire() {
+    if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+        return false;
+    }
+    readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & 3;
+    return true;
+}
+
+const uint32_t* TripleBuffer::ReadBuffer() const {
+    return &storage[readIndex * FRAME_PIXELS];
+}
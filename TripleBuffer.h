@@ -0,0 +1,40 @@
+// TripleBuffer.h
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+// Lock-free single-producer/single-consumer frame handoff. The producer
+// (emulation) always has a back buffer to render into and the consumer
+// (presentation) always has a front buffer to read; publishing and
+// acquiring swap buffer indices through the shared middle slot, so frames
+// are never copied and neither side ever waits for the other. If the
+// producer publishes twice before the consumer acquires, the older frame
+// is dropped.
+class TripleBuffer {
+public:
+    static const int FRAME_PIXELS = 256 * 240;
+
+    TripleBuffer();
+
+    // Producer side
+    uint32_t* WriteBuffer();
+    void Publish();
+    uint64_t Dropped() const;
+
+    // Consumer side. Acquire() returns false if nothing new was published
+    // since the last call, leaving ReadBuffer() on the previous frame.
+    bool Acquire();
+    const uint32_t* ReadBuffer() const;
+
+private:
+    // Middle slot: buffer index in bits 0-1, FRESH when it holds a frame
+    // the consumer has not seen
+    static const uint8_t FRESH = 0x04;
+
+    std::vector<uint32_t> storage;
+    std::atomic<uint8_t> middle;
+    uint8_t writeIndex; // Producer-owned
+    uint8_t readIndex;  // Consumer-owned
+    std::atomic<uint64_t> dropped;
+};
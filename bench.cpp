@@ -0,0 +1,494 @@
+// bench.cpp
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "NES.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Throughput benchmark for tracking regressions. Runs each ROM headless for
+// a fixed number of frames after a warm-up and reports emulated FPS, ns per
+// CPU instruction and ns per PPU dot, with hardware counters (IPC, cache
+// misses) from perf_event_open where the kernel allows it. Micro-benchmarks
+// time CPU::ExecuteInstruction, Memory::Read and PPU::Clock on their own,
+// on a machine built from the first ROM. Results are written as JSON;
+// progress goes to stderr.
+// Usage: nes_bench [-f frames] [-w warmup] [-r scanline|dot] [-m argb|indexed|none]
+//                  [-o results.json] [--no-micro] <rom.nes>...
+
+// Hardware counters for the calling thread, read as one group so ratios
+// between them are consistent. Counters the CPU or kernel does not offer
+// are left out; none are available where perf_event_open is missing or
+// not permitted (perf_event_paranoid, containers).
+class PerfCounters {
+public:
+    enum Counter {
+        CYCLES,
+        INSTRUCTIONS,
+        CACHE_REFERENCES,
+        CACHE_MISSES,
+        BRANCH_MISSES,
+        COUNT
+    };
+
+    struct Sample {
+        bool valid[COUNT];
+        uint64_t value[COUNT]; // Scaled up if the group was multiplexed
+    };
+
+    PerfCounters();
+    ~PerfCounters();
+    bool Available() const;
+    void Start();
+    Sample Stop();
+
+private:
+    int fds[COUNT];
+    int leader;
+};
+
+static const char* const COUNTER_NAMES[PerfCounters::COUNT] = {
+    "cycles", "instructions", "cache_references", "cache_misses", "branch_misses"
+};
+
+#if defined(__linux__)
+static int OpenCounter(uint64_t config, int group) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = group < 0 ? 1 : 0; // Members follow the leader
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+#endif
+
+PerfCounters::PerfCounters() : leader(-1) {
+    for (int i = 0; i < COUNT; i++) {
+        fds[i] = -1;
+    }
+#if defined(__linux__)
+    static const uint64_t configs[COUNT] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_REFERENCES,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for (int i = 0; i < COUNT; i++) {
+        fds[i] = OpenCounter(configs[i], leader);
+        if (leader < 0) {
+            leader = fds[i];
+        }
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#if defined(__linux__)
+    for (int i = 0; i < COUNT; i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::Available() const {
+    return leader >= 0;
+}
+
+void PerfCounters::Start() {
+#if defined(__linux__)
+    if (leader >= 0) {
+        ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+PerfCounters::Sample PerfCounters::Stop() {
+    Sample sample = {};
+#if defined(__linux__)
+    if (leader < 0) {
+        return sample;
+    }
+    ioctl(leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // Group layout: count, time enabled, time running, then one value per
+    // opened counter in the order they joined
+    uint64_t data[3 + COUNT];
+    if (read(leader, data, sizeof(data)) < (ssize_t)(3 * sizeof(uint64_t)) || data[2] == 0) {
+        return sample;
+    }
+    double scale = (double)data[1] / (double)data[2];
+    int next = 0;
+    for (int i = 0; i < COUNT && next < (int)data[0]; i++) {
+        if (fds[i] >= 0) {
+            sample.valid[i] = true;
+            sample.value[i] = (uint64_t)(data[3 + next++] * scale);
+        }
+    }
+#endif
+    return sample;
+}
+
+// Minimal JSON output: numbers, booleans and escaped strings
+static std::string JsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if ((unsigned char)c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+            out += escaped;
+        }
+        else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+static std::string JsonNumber(double value) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.6g", value);
+    return text;
+}
+
+static std::string JsonPerf(const PerfCounters::Sample& sample) {
+    std::string out = "{";
+    bool any = false;
+    for (int i = 0; i < PerfCounters::COUNT; i++) {
+        if (sample.valid[i]) {
+            out += std::string(any ? ", " : "") + "\"" + COUNTER_NAMES[i] + "\": " + std::to_string(sample.value[i]);
+            any = true;
+        }
+    }
+    if (!any) {
+        return "null";
+    }
+    if (sample.valid[PerfCounters::CYCLES] && sample.valid[PerfCounters::INSTRUCTIONS] &&
+        sample.value[PerfCounters::CYCLES] > 0) {
+        out += ", \"ipc\": " + JsonNumber((double)sample.value[PerfCounters::INSTRUCTIONS] /
+                                          sample.value[PerfCounters::CYCLES]);
+    }
+    if (sample.valid[PerfCounters::CACHE_REFERENCES] && sample.valid[PerfCounters::CACHE_MISSES] &&
+        sample.value[PerfCounters::CACHE_REFERENCES] > 0) {
+        out += ", \"cache_miss_rate\": " + JsonNumber((double)sample.value[PerfCounters::CACHE_MISSES] /
+                                                      sample.value[PerfCounters::CACHE_REFERENCES]);
+    }
+    return out + "}";
+}
+
+static double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static double PerUnit(double seconds, uint64_t units) {
+    return units ? seconds * 1e9 / (double)units : 0.0;
+}
+
+struct Options {
+    uint64_t frames = 600;
+    uint64_t warmup = 60;
+    PPU::RenderMode render = PPU::RENDER_SCANLINE;
+    PPU::OutputMode output = PPU::OUTPUT_ARGB;
+    bool micro = true;
+    const char* outFile = nullptr;
+    std::vector<std::string> roms;
+};
+
+// One ROM: warm up, then time a fixed number of frames
+static std::string RunRom(const std::string& path, const Options& options, PerfCounters& perf, bool& ok) {
+    Cartridge cartridge(path);
+    if (!cartridge.Load()) {
+        ok = false;
+        return "{\"rom\": " + JsonString(path) + ", \"error\": \"load failed\"}";
+    }
+
+    NES nes(&cartridge);
+    nes.Reset();
+    nes.ppu.SetRenderMode(options.render);
+    nes.ppu.SetOutputMode(options.output);
+    while (nes.Running() && nes.FrameCount() < options.warmup) {
+        nes.RunFrame();
+    }
+
+    uint64_t firstFrame = nes.FrameCount();
+    uint64_t firstCycle = nes.CycleCount();
+    uint64_t firstInstruction = nes.cpu.instructionCount;
+    perf.Start();
+    auto start = std::chrono::steady_clock::now();
+    while (nes.Running() && nes.FrameCount() - firstFrame < options.frames) {
+        nes.RunFrame();
+    }
+    double seconds = Seconds(start);
+    PerfCounters::Sample counters = perf.Stop();
+
+    uint64_t frames = nes.FrameCount() - firstFrame;
+    uint64_t cycles = nes.CycleCount() - firstCycle;
+    uint64_t instructions = nes.cpu.instructionCount - firstInstruction;
+    std::fprintf(stderr, "%s: %.1f fps\n", path.c_str(), seconds > 0 ? frames / seconds : 0.0);
+
+    return "{\"rom\": " + JsonString(path) +
+           ", \"frames\": " + std::to_string(frames) +
+           ", \"cpu_cycles\": " + std::to_string(cycles) +
+           ", \"instructions\": " + std::to_string(instructions) +
+           ", \"seconds\": " + JsonNumber(seconds) +
+           ", \"fps\": " + JsonNumber(seconds > 0 ? frames / seconds : 0.0) +
+           ", \"ns_per_instruction\": " + JsonNumber(PerUnit(seconds, instructions)) +
+           ", \"ns_per_ppu_dot\": " + JsonNumber(PerUnit(seconds, cycles * 3)) +
+           ", \"halted\": " + (nes.Running() ? "false" : "true") +
+           ", \"perf\": " + JsonPerf(counters) + "}";
+}
+
+// CPU::ExecuteInstruction alone, on a loop of common instructions in RAM
+// (zero page and absolute indexed loads and stores, (zp),Y, ALU, JSR/RTS,
+// stack and branches). The PPU and APU are never stepped and no interrupts
+// are taken.
+static std::string MicroCPU(Cartridge& cartridge, PerfCounters& perf) {
+    static const uint8_t program[] = {
+        0xA2, 0x00,       // $0200 LDX #$00
+        0xB5, 0x10,       // $0202 LDA $10,X
+        0x18,             //       CLC
+        0x69, 0x03,       //       ADC #$03
+        0x95, 0x10,       //       STA $10,X
+        0xBD, 0x00, 0x03, //       LDA $0300,X
+        0x49, 0x5A,       //       EOR #$5A
+        0x9D, 0x00, 0x03, //       STA $0300,X
+        0xB1, 0xF0,       //       LDA ($F0),Y
+        0xC8,             //       INY
+        0x20, 0x20, 0x02, //       JSR $0220
+        0xE8,             //       INX
+        0xE0, 0x40,       //       CPX #$40
+        0xD0, 0xE6,       //       BNE $0202
+        0x4C, 0x00, 0x02, //       JMP $0200
+        0xEA,             //       (padding)
+        0x48,             // $0220 PHA
+        0x0A,             //       ASL A
+        0x68,             //       PLA
+        0x60,             //       RTS
+    };
+    const uint64_t calls = 30000000;
+
+    NES nes(&cartridge);
+    nes.Reset();
+    for (size_t i = 0; i < sizeof(program); i++) {
+        nes.memory.Write((uint16_t)(0x0200 + i), program[i]);
+    }
+    nes.memory.Write(0x00F0, 0x00); // ($F0) points at $0400
+    nes.memory.Write(0x00F1, 0x04);
+    nes.cpu.PC = 0x0200;
+    nes.cpu.cycles = 0;
+
+    uint64_t firstInstruction = nes.cpu.instructionCount;
+    perf.Start();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < calls; i++) {
+        nes.cpu.ExecuteInstruction();
+    }
+    double seconds = Seconds(start);
+    PerfCounters::Sample counters = perf.Stop();
+    uint64_t instructions = nes.cpu.instructionCount - firstInstruction;
+
+    return "{\"calls\": " + std::to_string(calls) +
+           ", \"instructions\": " + std::to_string(instructions) +
+           ", \"seconds\": " + JsonNumber(seconds) +
+           ", \"ns_per_call\": " + JsonNumber(PerUnit(seconds, calls)) +
+           ", \"ns_per_instruction\": " + JsonNumber(PerUnit(seconds, instructions)) +
+           ", \"perf\": " + JsonPerf(counters) + "}";
+}
+
+// Memory::Read through the page table over internal RAM and PRG ROM, at
+// pseudo-random addresses so the branch predictor cannot learn the pattern
+static std::string MicroMemoryRead(Cartridge& cartridge, PerfCounters& perf) {
+    const uint64_t reads = 50000000;
+
+    NES nes(&cartridge);
+    nes.Reset();
+    std::vector<uint16_t> addresses(4096);
+    uint32_t random = 0x9E3779B9u;
+    for (uint16_t& address : addresses) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        address = (random & 1) ? (uint16_t)(0x8000 | (random >> 16)) : (uint16_t)((random >> 16) & 0x1FFF);
+    }
+
+    uint32_t sum = 0;
+    perf.Start();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < reads; i++) {
+        sum += nes.memory.Read(addresses[i & 4095]);
+    }
+    double seconds = Seconds(start);
+    PerfCounters::Sample counters = perf.Stop();
+
+    volatile uint32_t sink = sum; // Keeps the loop from being optimized away
+    (void)sink;
+    return "{\"reads\": " + std::to_string(reads) +
+           ", \"seconds\": " + JsonNumber(seconds) +
+           ", \"ns_per_read\": " + JsonNumber(PerUnit(seconds, reads)) +
+           ", \"perf\": " + JsonPerf(counters) + "}";
+}
+
+// PPU::Clock alone, dot by dot, after the ROM has run long enough to turn
+// rendering on. The CPU does not run meanwhile.
+static std::string MicroPPUClock(Cartridge& cartridge, PPU::RenderMode mode, PerfCounters& perf) {
+    const uint64_t dots = 60 * 341 * 262;
+
+    NES nes(&cartridge);
+    nes.Reset();
+    nes.ppu.SetRenderMode(mode);
+    while (nes.Running() && nes.FrameCount() < 120) {
+        nes.RunFrame();
+    }
+
+    perf.Start();
+    auto start = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < dots; i++) {
+        nes.ppu.Clock();
+    }
+    double seconds = Seconds(start);
+    PerfCounters::Sample counters = perf.Stop();
+
+    return std::string("{\"render\": ") + (mode == PPU::RENDER_DOT ? "\"dot\"" : "\"scanline\"") +
+           ", \"dots\": " + std::to_string(dots) +
+           ", \"seconds\": " + JsonNumber(seconds) +
+           ", \"ns_per_dot\": " + JsonNumber(PerUnit(seconds, dots)) +
+           ", \"perf\": " + JsonPerf(counters) + "}";
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-f" && hasValue) {
+            options.frames = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-w" && hasValue) {
+            options.warmup = std::strtoull(argv[++i], nullptr, 10);
+        }
+        else if (arg == "-r" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "dot") {
+                options.render = PPU::RENDER_DOT;
+            }
+            else if (mode == "scanline") {
+                options.render = PPU::RENDER_SCANLINE;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (arg == "-m" && hasValue) {
+            std::string mode = argv[++i];
+            if (mode == "argb") {
+                options.output = PPU::OUTPUT_ARGB;
+            }
+            else if (mode == "indexed") {
+                options.output = PPU::OUTPUT_INDEXED;
+            }
+            else if (mode == "none") {
+                options.output = PPU::OUTPUT_NONE;
+            }
+            else {
+                return false;
+            }
+        }
+        else if (arg == "-o" && hasValue) {
+            options.outFile = argv[++i];
+        }
+        else if (arg == "--no-micro") {
+            options.micro = false;
+        }
+        else if (!arg.empty() && arg[0] == '-') {
+            return false;
+        }
+        else {
+            options.roms.push_back(arg);
+        }
+    }
+    return !options.roms.empty();
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "Usage: %s [-f frames] [-w warmup] [-r scanline|dot] [-m argb|indexed|none]\n"
+                             "       [-o results.json] [--no-micro] <rom.nes>...\n", argv[0]);
+        return 1;
+    }
+
+    // Cartridge logs to std::cout; keep stdout for the JSON
+    std::cout.rdbuf(std::cerr.rdbuf());
+
+    PerfCounters perf;
+    if (!perf.Available()) {
+        std::fprintf(stderr, "Hardware counters unavailable; reporting timings only\n");
+    }
+
+    bool ok = true;
+    std::vector<std::string> roms;
+    for (const std::string& rom : options.roms) {
+        roms.push_back(RunRom(rom, options, perf, ok));
+    }
+
+    std::vector<std::string> micro;
+    if (options.micro) {
+        Cartridge cartridge(options.roms[0]);
+        if (cartridge.Load()) {
+            std::fprintf(stderr, "Micro-benchmarks on %s\n", options.roms[0].c_str());
+            micro.push_back("\"cpu_execute_instruction\": " + MicroCPU(cartridge, perf));
+            micro.push_back("\"memory_read\": " + MicroMemoryRead(cartridge, perf));
+            micro.push_back("\"ppu_clock\": [" + MicroPPUClock(cartridge, PPU::RENDER_SCANLINE, perf) + ", " +
+                            MicroPPUClock(cartridge, PPU::RENDER_DOT, perf) + "]");
+        }
+    }
+
+    static const char* const renderNames[] = { "dot", "scanline" };
+    static const char* const outputNames[] = { "argb", "indexed", "none" };
+    FILE* out = options.outFile ? std::fopen(options.outFile, "w") : stdout;
+    if (!out) {
+        std::fprintf(stderr, "Could not open %s\n", options.outFile);
+        return 1;
+    }
+    std::fprintf(out, "{\n");
+    std::fprintf(out, "  \"schema\": 1,\n");
+    std::fprintf(out, "  \"timestamp\": %lld,\n", (long long)std::time(nullptr));
+    std::fprintf(out, "  \"config\": {\"frames\": %llu, \"warmup\": %llu, \"render\": \"%s\", \"output\": \"%s\", "
+                      "\"cpu_dispatch\": \"%s\", \"trace\": %s},\n",
+                 (unsigned long long)options.frames, (unsigned long long)options.warmup,
+                 renderNames[options.render], outputNames[options.output],
+                 NES_CPU_SWITCH ? "switch" : "table", NES_TRACE ? "true" : "false");
+    std::fprintf(out, "  \"perf_available\": %s,\n", perf.Available() ? "true" : "false");
+    std::fprintf(out, "  \"roms\": [\n");
+    for (size_t i = 0; i < roms.size(); i++) {
+        std::fprintf(out, "    %s%s\n", roms[i].c_str(), i + 1 < roms.size() ? "," : "");
+    }
+    std::fprintf(out, "  ],\n");
+    std::fprintf(out, "  \"micro\": {");
+    for (size_t i = 0; i < micro.size(); i++) {
+        std::fprintf(out, "%s\n    %s", i ? "," : "", micro[i].c_str());
+    }
+    std::fprintf(out, "%s}\n}\n", micro.empty() ? "" : "\n  ");
+    if (out != stdout) {
+        std::fclose(out);
+    }
+
+    return ok ? 0 : 1;
+}
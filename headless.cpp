@@ -0,0 +1,57 @@
+// headless.cpp
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include "NES.h"
+
+// Runs a ROM with no window, audio or input for a fixed number of frames
+// and reports the emulation speed.
+// Usage: nes_headless <rom> [frames] [trace.bin]
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cout << "Usage: " << argv[0] << " <rom.nes> [frames] [trace.bin]" << std::endl;
+        return 1;
+    }
+
+    uint64_t frames = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 600;
+
+    Cartridge cartridge(argv[1]);
+    if (!cartridge.Load()) {
+        std::cout << "Failed to load ROM" << std::endl;
+        return 1;
+    }
+
+    NES nes(&cartridge);
+    nes.Reset();
+
+    TraceWriter trace;
+    if (argc > 3) {
+#if NES_TRACE
+        if (!trace.Open(argv[3])) {
+            return 1;
+        }
+        nes.cpu.AttachTrace(&trace);
+#else
+        std::cout << "Tracing not compiled in (configure with -DNES_ENABLE_TRACE=ON)" << std::endl;
+#endif
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    while (nes.Running() && nes.FrameCount() < frames) {
+        nes.RunFrame();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    nes.cpu.AttachTrace(nullptr);
+    trace.Close();
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "Frames: " << nes.FrameCount() << std::endl;
+    std::cout << "CPU cycles: " << nes.CycleCount() << std::endl;
+    std::cout << "Time: " << seconds << " s" << std::endl;
+    if (seconds > 0) {
+        std::cout << "FPS: " << nes.FrameCount() / seconds << std::endl;
+    }
+
+    return nes.Running() ? 0 : 1;
+}
@@ -1,12 +1,79 @@
 // main.cpp
 #include <SDL.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
-#include "CPU.h"
-#include "Memory.h"
-#include "PPU.h"
-#include "Controller.h"
-#include "Cartridge.h"
+#include <memory>
+#include <thread>
+#include "NES.h"
+#include "AudioRateControl.h"
+#include "AudioRing.h"
+#include "FramePacer.h"
+#include "Rewind.h"
+#include "RunAhead.h"
+#include "TripleBuffer.h"
+
+// Total audio latency to aim for: device buffer plus ring fill
+static const int AUDIO_LATENCY_MS = 25;
+
+// Rewind history: a snapshot every other frame in 64MB of deltas, which
+// holds hours of play; holding Backspace rewinds at twice normal speed
+static const size_t REWIND_BUFFER_BYTES = 64 << 20;
+static const int REWIND_INTERVAL = 2;
+
+// SDL audio callback: drains the ring, padding with silence on underrun
+static void AudioCallback(void* userdata, Uint8* stream, int len) {
+    AudioRing* ring = static_cast<AudioRing*>(userdata);
+    int16_t* samples = reinterpret_cast<int16_t*>(stream);
+    size_t count = len / sizeof(int16_t);
+    size_t read = ring->Read(samples, count);
+    std::memset(samples + read, 0, (count - read) * sizeof(int16_t));
+}
+
+// Emulation thread: runs and paces frames, rendering each straight into the
+// triple buffer's back buffer, so a blocking present (vsync, a slow
+// compositor) on the main thread never stalls the core. Each frame's audio
+// goes to the ring in one bulk write, and the ring's fill level steers the
+// APU's resampling ratio for the next frame. While rewinding, each frame
+// steps back one snapshot and runs a frame from there to show it; those
+// frames are not captured. Frames come from the run-ahead display core.
+static void EmulationThread(NES* nes, RunAhead* runAhead, TripleBuffer* frames, AudioRing* audio,
+                            AudioRateControl* rateControl, const std::atomic<uint8_t>* buttons,
+                            const std::atomic<bool>* rewinding, std::atomic<bool>* running) {
+    FramePacer pacer;
+    Rewind rewind(nes, REWIND_BUFFER_BYTES, REWIND_INTERVAL);
+    int16_t samples[4096];
+    PPU& display = runAhead->Display()->ppu;
+
+    display.SetFrameBuffer(frames->WriteBuffer());
+    while (running->load(std::memory_order_relaxed) && nes->Running()) {
+        bool rewound = rewinding->load(std::memory_order_relaxed) && rewind.Step();
+        runAhead->RunFrame(buttons->load(std::memory_order_relaxed));
+        if (!rewound) {
+            rewind.Capture();
+        }
+
+        // The frame wraps before line 0 is drawn, so the PPU can switch to
+        // the new back buffer here
+        frames->Publish();
+        display.SetFrameBuffer(frames->WriteBuffer());
+
+        int count = nes->apu.ReadSamples(samples, 4096);
+        size_t fill = audio->Available();
+        audio->Write(samples, count);
+        if (rateControl) {
+            nes->apu.SetResampleRatio(rateControl->Update(fill, count));
+        }
 
+        pacer.WaitForNextFrame();
+    }
+    running->store(false, std::memory_order_relaxed);
+}
+
+// Usage: NES_Emulator [rom.nes] [run-ahead frames] [shadow]
+// "shadow" runs the look-ahead on a second core instead of rolling back
 int main(int argc, char* argv[]) {
     // Initialize SDL
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER) != 0) {
@@ -23,11 +90,12 @@ int main(int argc, char* argv[]) {
     }
 
     // Create renderer and texture
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
     SDL_Texture* texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, 256, 240);
 
     // Load cartridge
-    Cartridge cartridge("D:\\ROMS\\Mario\\color_test.nes");
+    const char* romPath = argc > 1 ? argv[1] : "D:\\ROMS\\Mario\\color_test.nes";
+    Cartridge cartridge(romPath);
 
     if (!cartridge.Load()) {
         std::cout << "Failed to load ROM" << std::endl;
@@ -39,96 +107,136 @@ int main(int argc, char* argv[]) {
     }
 
     // Initialize components
-    PPU ppu(&cartridge);
-    Memory memory(&cartridge);
-    CPU cpu(&memory, &ppu);
-    Controller controller1;
-
-    memory.ConnectPPU(&ppu);
-    memory.ConnectController(&controller1);
-
-    cpu.Reset();
-    ppu.Reset();
+    NES nes(&cartridge);
+    nes.Reset();
+
+    // Run-ahead, optionally on a shadow core with its own copy of the ROM
+    bool useShadow = argc > 3 && std::strcmp(argv[3], "shadow") == 0;
+    Cartridge shadowCartridge(romPath);
+    std::unique_ptr<NES> shadow;
+    if (useShadow && shadowCartridge.Load()) {
+        shadow.reset(new NES(&shadowCartridge));
+    }
+    RunAhead runAhead(&nes, shadow.get());
+    runAhead.SetFrames(argc > 2 ? std::atoi(argv[2]) : 0);
+
+    // Audio output: mono 16-bit, fed from the APU through a lock-free ring
+    AudioRing audio;
+    SDL_AudioSpec desired = {};
+    SDL_AudioSpec obtained = {};
+    desired.freq = 48000;
+    desired.format = AUDIO_S16SYS;
+    desired.channels = 1;
+    desired.samples = 256;
+    desired.callback = AudioCallback;
+    desired.userdata = &audio;
+    SDL_AudioDeviceID audioDevice = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (audioDevice) {
+        nes.apu.SetSampleRate(obtained.freq);
+    }
+    else {
+        std::cout << "SDL_OpenAudioDevice Error: " << SDL_GetError() << std::endl;
+        nes.apu.SetSampleRate(0);
+    }
 
-    // Emulation loop
-    bool running = true;
+    // Whatever the device buffer does not cover is kept in the ring, on
+    // average; at least a frame, since samples arrive a frame at a time
+    size_t samplesPerFrame = (size_t)(obtained.freq / FramePacer::NTSC_FRAME_RATE) + 1;
+    size_t latencySamples = (size_t)obtained.freq * AUDIO_LATENCY_MS / 1000;
+    size_t targetFill = std::max(latencySamples - std::min<size_t>(obtained.samples, latencySamples), samplesPerFrame);
+    AudioRateControl rateControl(targetFill);
+    bool audioStarted = false;
+
+    TripleBuffer frames;
+    std::atomic<uint8_t> buttons(0);
+    std::atomic<bool> rewinding(false);
+    std::atomic<bool> running(true);
+    std::thread emulation(EmulationThread, &nes, &runAhead, &frames, &audio, audioDevice ? &rateControl : nullptr,
+                          &buttons, &rewinding, &running);
+
+    // Main thread: SDL events and presentation
     SDL_Event event;
-    uint32_t lastTime = SDL_GetTicks();
+    uint8_t buttonStates = 0;
 
-    while (running && cpu.running) {
+    while (running.load(std::memory_order_relaxed)) {
         // Handle events
         while (SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) {
                 running = false;
             }
+            else if ((event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) && event.key.keysym.sym == SDLK_BACKSPACE) {
+                rewinding.store(event.type == SDL_KEYDOWN, std::memory_order_relaxed);
+            }
             else if (event.type == SDL_KEYDOWN || event.type == SDL_KEYUP) {
-                bool pressed = (event.type == SDL_KEYDOWN);
+                int button = -1;
                 switch (event.key.keysym.sym) {
                 case SDLK_z:
-                    controller1.SetButtonState(0, pressed); // A Button
+                    button = 0; // A Button
                     break;
                 case SDLK_x:
-                    controller1.SetButtonState(1, pressed); // B Button
+                    button = 1; // B Button
                     break;
                 case SDLK_RSHIFT:
                 case SDLK_c:
-                    controller1.SetButtonState(2, pressed); // Select Button
+                    button = 2; // Select Button
                     break;
                 case SDLK_RETURN:
-                    controller1.SetButtonState(3, pressed); // Start Button
+                    button = 3; // Start Button
                     break;
                 case SDLK_UP:
-                    controller1.SetButtonState(4, pressed); // Up
+                    button = 4; // Up
                     break;
                 case SDLK_DOWN:
-                    controller1.SetButtonState(5, pressed); // Down
+                    button = 5; // Down
                     break;
                 case SDLK_LEFT:
-                    controller1.SetButtonState(6, pressed); // Left
+                    button = 6; // Left
                     break;
                 case SDLK_RIGHT:
-                    controller1.SetButtonState(7, pressed); // Right
+                    button = 7; // Right
                     break;
                 }
+                if (button >= 0) {
+                    if (event.type == SDL_KEYDOWN)
+                        buttonStates |= (1 << button);
+                    else
+                        buttonStates &= ~(1 << button);
+                    buttons.store(buttonStates, std::memory_order_relaxed);
+                }
             }
         }
 
-        // Emulate CPU cycles
-        if (cpu.cycles == 0) {
-            cpu.ExecuteInstruction();
+        // Start playback once the ring first reaches its target fill
+        if (audioDevice && !audioStarted && audio.Available() >= targetFill) {
+            SDL_PauseAudioDevice(audioDevice, 0);
+            audioStarted = true;
         }
-        cpu.cycles--;
 
-        // PPU cycles (three PPU cycles per CPU cycle)
-        for (int i = 0; i < 3; ++i) {
-            ppu.Clock();
-
-            // Handle NMI
-            if (ppu.nmi) {
-                ppu.nmi = false;
-                cpu.NMI();
-            }
+        // Present the newest completed frame, if any
+        if (!frames.Acquire()) {
+            SDL_Delay(1);
+            continue;
         }
+        SDL_UpdateTexture(texture, NULL, frames.ReadBuffer(), 256 * sizeof(uint32_t));
 
-        // Render frame if ready
-        if (ppu.FrameReady()) {
-            SDL_UpdateTexture(texture, NULL, ppu.GetFrameBuffer(), 256 * sizeof(uint32_t));
+        // Scale the output to fit the window
+        SDL_Rect srcRect = { 0, 0, 256, 240 };
+        SDL_Rect dstRect = { 0, 0, 256 * 2, 240 * 2 }; // Scale by 2x
 
-            // Scale the output to fit the window
-            SDL_Rect srcRect = { 0, 0, 256, 240 };
-            SDL_Rect dstRect = { 0, 0, 256 * 2, 240 * 2 }; // Scale by 2x
+        SDL_RenderClear(renderer);
+        SDL_RenderCopy(renderer, texture, &srcRect, &dstRect);
+        SDL_RenderPresent(renderer);
+    }
 
-            SDL_RenderClear(renderer);
-            SDL_RenderCopy(renderer, texture, &srcRect, &dstRect);
-            SDL_RenderPresent(renderer);
-        }
+    emulation.join();
+    if (audioDevice) {
+        SDL_CloseAudioDevice(audioDevice);
 
-        // Frame limiting (optional)
-        uint32_t currentTime = SDL_GetTicks();
-        if (currentTime - lastTime < 16) {
-            SDL_Delay(16 - (currentTime - lastTime));
-        }
-        lastTime = currentTime;
+        const AudioRateControl::Metrics& metrics = rateControl.GetMetrics();
+        std::cout << "Audio: " << audio.Underruns() << " underruns (" << audio.UnderrunSamples() << " samples), "
+                  << audio.DroppedSamples() << " samples dropped, resample ratio " << metrics.ratio
+                  << " [" << metrics.minRatio << ", " << metrics.maxRatio << "], average fill "
+                  << metrics.averageFill << "/" << metrics.targetFill << std::endl;
     }
 
     // Clean up
@@ -0,0 +1,1196 @@
+// tests.cpp
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "AudioRing.h"
+#include "BatchEnv.h"
+#include "NES.h"
+#include "Rewind.h"
+#include "RomImage.h"
+#include "RunAhead.h"
+#include "SessionScheduler.h"
+#include "SharedPages.h"
+
+// Self-contained regression tests, run by CTest. The test ROM is built
+// here, so no ROM files are needed.
+// Usage: nes_tests
+
+static int failures = 0;
+
+#define CHECK(condition)                                                            \
+    do {                                                                            \
+        if (!(condition)) {                                                         \
+            std::printf("%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+// Small 6502 assembler: bytes at increasing addresses plus branch fixups
+class Assembler {
+public:
+    explicit Assembler(uint16_t origin) : origin(origin) {}
+
+    uint16_t Here() const { return (uint16_t)(origin + code.size()); }
+
+    void Emit(std::initializer_list<int> bytes) {
+        for (int byte : bytes) {
+            code.push_back((uint8_t)byte);
+        }
+    }
+
+    void Absolute(uint8_t opcode, uint16_t address) {
+        Emit({ opcode, address & 0xFF, address >> 8 });
+    }
+
+    void Branch(uint8_t opcode, uint16_t target) {
+        Emit({ opcode, (uint8_t)(target - (Here() + 2)) });
+    }
+
+    // A branch to a later point, fixed up by Land() once it is reached
+    size_t Forward(uint8_t opcode) {
+        Emit({ opcode, 0 });
+        return code.size() - 1;
+    }
+
+    void Land(size_t branch) {
+        code[branch] = (uint8_t)(code.size() - (branch + 1));
+    }
+
+    const std::vector<uint8_t>& Code() const { return code; }
+
+private:
+    uint16_t origin;
+    std::vector<uint8_t> code;
+};
+
+// The NMI, reset and IRQ vectors at the end of prg
+static void SetVectors(std::vector<uint8_t>& prg, uint16_t nmi, uint16_t reset, uint16_t irq) {
+    const uint16_t vectors[3] = { nmi, reset, irq };
+    for (int i = 0; i < 3; i++) {
+        prg[prg.size() - 6 + i * 2] = vectors[i] & 0xFF;
+        prg[prg.size() - 5 + i * 2] = vectors[i] >> 8;
+    }
+}
+
+// An iNES file; no CHR means CHR RAM. flags6 carries the mirroring bits.
+static std::string WriteROM(const std::string& filename, const std::vector<uint8_t>& prg,
+                            const std::vector<uint8_t>& chr, uint8_t mapper, uint8_t flags6) {
+    const uint8_t header[16] = { 'N', 'E', 'S', 0x1A, (uint8_t)(prg.size() / 16384), (uint8_t)(chr.size() / 8192),
+                                 (uint8_t)((mapper << 4) | flags6), (uint8_t)(mapper & 0xF0) };
+    std::ofstream file(filename, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(prg.data()), prg.size());
+    file.write(reinterpret_cast<const char*>(chr.data()), chr.size());
+    return filename;
+}
+
+// NROM, 16KB PRG ROM, CHR RAM. Every frame the NMI handler reads the
+// controller, writes a name table byte and a CHR RAM byte that depend on
+// the frame and input, and DMAs sprites from page $02; the main loop
+// keeps changing RAM and a pulse channel register.
+static std::string WriteTestROM() {
+    Assembler a(0xC000);
+
+    uint16_t reset = a.Here();
+    a.Emit({ 0x78, 0xD8, 0xA2, 0xFF, 0x9A });  // SEI; CLD; LDX #$FF; TXS
+    for (int i = 0; i < 2; i++) {
+        uint16_t wait = a.Here();
+        a.Absolute(0x2C, 0x2002);             // BIT $2002
+        a.Branch(0x10, wait);                 // BPL wait
+    }
+    a.Emit({ 0xA9, 0x80 });                   // LDA #$80
+    a.Absolute(0x8D, 0x2000);                 // STA $2000 (NMI on)
+    a.Emit({ 0xA9, 0x1E });                   // LDA #$1E
+    a.Absolute(0x8D, 0x2001);                 // STA $2001 (rendering on)
+    a.Emit({ 0xA9, 0x0F });                   // LDA #$0F
+    a.Absolute(0x8D, 0x4015);                 // STA $4015 (channels on)
+
+    uint16_t main = a.Here();
+    a.Emit({ 0xE6, 0x00 });                   // INC $00
+    a.Emit({ 0xA6, 0x02 });                   // LDX $02
+    a.Emit({ 0xA5, 0x00 });                   // LDA $00
+    a.Absolute(0x9D, 0x0200);                 // STA $0200,X (sprites)
+    a.Absolute(0x9D, 0x0300);                 // STA $0300,X
+    a.Emit({ 0x65, 0x01 });                   // ADC $01
+    a.Absolute(0x9D, 0x0500);                 // STA $0500,X
+    a.Absolute(0x8D, 0x4002);                 // STA $4002
+    a.Absolute(0x4C, main);                   // JMP main
+
+    uint16_t nmi = a.Here();
+    a.Emit({ 0x48, 0x8A, 0x48 });             // PHA; TXA; PHA
+    a.Emit({ 0xA9, 0x01 });
+    a.Absolute(0x8D, 0x4016);                 // Strobe the controller
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x4016);
+    for (int i = 0; i < 8; i++) {
+        a.Absolute(0xAD, 0x4016);             // LDA $4016
+        a.Emit({ 0x4A, 0x26, 0x01 });         // LSR A; ROL $01
+    }
+    a.Emit({ 0xE6, 0x02 });                   // INC $02
+    a.Absolute(0xAD, 0x2002);                 // Reset the address latch
+    a.Emit({ 0xA9, 0x20 });
+    a.Absolute(0x8D, 0x2006);
+    a.Emit({ 0xA5, 0x02 });
+    a.Absolute(0x8D, 0x2006);                 // $20xx, xx = frame
+    a.Emit({ 0xA5, 0x01 });
+    a.Absolute(0x8D, 0x2007);                 // Name table byte = input
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x2006);
+    a.Emit({ 0xA5, 0x02 });
+    a.Absolute(0x8D, 0x2006);                 // $00xx, xx = frame
+    a.Emit({ 0xA5, 0x00, 0x45, 0x01 });       // LDA $00; EOR $01
+    a.Absolute(0x8D, 0x2007);                 // CHR RAM byte
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x2005);
+    a.Absolute(0x8D, 0x2005);                 // Scroll 0,0
+    a.Emit({ 0xA9, 0x80 });
+    a.Absolute(0x8D, 0x2000);
+    a.Emit({ 0xA9, 0x02 });
+    a.Absolute(0x8D, 0x4014);                 // OAM DMA from $0200
+    a.Emit({ 0x68, 0xAA, 0x68, 0x40 });       // PLA; TAX; PLA; RTI
+
+    std::vector<uint8_t> prg(16384, 0xEA);
+    std::memcpy(prg.data(), a.Code().data(), a.Code().size());
+    SetVectors(prg, nmi, reset, nmi);
+    return WriteROM("nes_tests.nes", prg, {}, 0, 0x01);
+}
+
+// NROM, 16KB PRG ROM, CHR RAM, drawn to stress the renderers. Reset fills
+// CHR RAM, both name tables and the palettes with varied data and page $02
+// with 64 pseudo-random sprites. Every frame the NMI moves the sprites,
+// picks scroll, name table, pattern tables, sprite size and mask bits from
+// the frame count and input, then waits into the visible frame, polls
+// $2002 for sprite 0 hit and changes scroll and control mid-line.
+static std::string WriteRenderROM() {
+    Assembler a(0xC000);
+
+    uint16_t reset = a.Here();
+    a.Emit({ 0x78, 0xD8, 0xA2, 0xFF, 0x9A });  // SEI; CLD; LDX #$FF; TXS
+    for (int i = 0; i < 2; i++) {
+        uint16_t wait = a.Here();
+        a.Absolute(0x2C, 0x2002);             // BIT $2002
+        a.Branch(0x10, wait);                 // BPL wait
+    }
+
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x2006);
+    a.Absolute(0x8D, 0x2006);                 // CHR RAM from $0000
+    a.Emit({ 0xA0, 0x00 });                   // LDY #0
+    uint16_t chrPage = a.Here();
+    a.Emit({ 0x84, 0x10, 0xA2, 0x00 });       // STY $10; LDX #0
+    uint16_t chrByte = a.Here();
+    a.Emit({ 0x8A, 0x45, 0x10 });             // TXA; EOR $10
+    a.Absolute(0x8D, 0x2007);
+    a.Emit({ 0xE8 });                         // INX
+    a.Branch(0xD0, chrByte);
+    a.Emit({ 0xC8, 0xC0, 0x20 });             // INY; CPY #$20
+    a.Branch(0xD0, chrPage);
+
+    a.Emit({ 0xA9, 0x20 });
+    a.Absolute(0x8D, 0x2006);
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x2006);                 // Name tables from $2000
+    a.Emit({ 0xA0, 0x00 });
+    uint16_t ntPage = a.Here();
+    a.Emit({ 0x84, 0x10, 0xA2, 0x00 });
+    uint16_t ntByte = a.Here();
+    a.Emit({ 0x8A, 0x18, 0x65, 0x10 });       // TXA; CLC; ADC $10
+    a.Absolute(0x8D, 0x2007);
+    a.Emit({ 0xE8 });
+    a.Branch(0xD0, ntByte);
+    a.Emit({ 0xC8, 0xC0, 0x08 });             // 8 pages: both tables, mirrored
+    a.Branch(0xD0, ntPage);
+
+    a.Emit({ 0xA9, 0x3F });
+    a.Absolute(0x8D, 0x2006);
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x2006);                 // Palettes
+    a.Emit({ 0xA2, 0x00 });
+    uint16_t palette = a.Here();
+    a.Emit({ 0x8A, 0x0A, 0x0A, 0x69, 0x07, 0x29, 0x3F }); // TXA; ASL; ASL; ADC #7; AND #$3F
+    a.Absolute(0x8D, 0x2007);
+    a.Emit({ 0xE8, 0xE0, 0x20 });             // INX; CPX #$20
+    a.Branch(0xD0, palette);
+
+    a.Emit({ 0xA2, 0x00, 0xA9, 0x5A, 0x85, 0x11 }); // LDX #0; LDA #$5A; STA $11
+    uint16_t sprite = a.Here();
+    a.Emit({ 0xA5, 0x11, 0x0A, 0x69, 0x1D, 0x85, 0x11 }); // LDA $11; ASL; ADC #$1D; STA $11
+    a.Absolute(0x9D, 0x0200);                 // STA $0200,X
+    a.Emit({ 0xE8 });
+    a.Branch(0xD0, sprite);
+    a.Emit({ 0xA9, 0x05 });
+    a.Absolute(0x8D, 0x0201);                 // Sprite 0: tile 5, front, x=$80
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x0202);
+    a.Emit({ 0xA9, 0x80 });
+    a.Absolute(0x8D, 0x0203);
+
+    uint16_t wait = a.Here();
+    a.Absolute(0x2C, 0x2002);
+    a.Branch(0x10, wait);
+    a.Emit({ 0xA9, 0x80 });
+    a.Absolute(0x8D, 0x2000);                 // NMI on
+    a.Emit({ 0xA9, 0x1E });
+    a.Absolute(0x8D, 0x2001);                 // Rendering on
+    uint16_t main = a.Here();
+    a.Emit({ 0xE6, 0x00 });                   // INC $00
+    a.Absolute(0x4C, main);
+
+    uint16_t nmi = a.Here();
+    a.Emit({ 0x48, 0x8A, 0x48, 0x98, 0x48 }); // PHA; TXA; PHA; TYA; PHA
+    a.Emit({ 0xA9, 0x02 });
+    a.Absolute(0x8D, 0x4014);                 // OAM DMA from $0200
+    a.Emit({ 0xA9, 0x01 });
+    a.Absolute(0x8D, 0x4016);
+    a.Emit({ 0xA9, 0x00 });
+    a.Absolute(0x8D, 0x4016);
+    for (int i = 0; i < 8; i++) {
+        a.Absolute(0xAD, 0x4016);
+        a.Emit({ 0x4A, 0x26, 0x01 });         // LSR A; ROL $01 (input)
+    }
+    a.Emit({ 0xE6, 0x02 });                   // INC $02 (frame)
+
+    a.Emit({ 0xA2, 0x04 });                   // Move sprites 1-63
+    uint16_t move = a.Here();
+    a.Absolute(0xBD, 0x0203);
+    a.Emit({ 0x18, 0x65, 0x01 });             // X += input
+    a.Absolute(0x9D, 0x0203);
+    a.Absolute(0xBD, 0x0200);
+    a.Emit({ 0x69, 0x01 });                   // Y += 1 (+ carry)
+    a.Absolute(0x9D, 0x0200);
+    a.Emit({ 0xE8, 0xE8, 0xE8, 0xE8 });
+    a.Branch(0xD0, move);
+    a.Emit({ 0xA5, 0x02, 0x29, 0x7F, 0x69, 0x20 }); // Sprite 0 y = $20 + frame % 128
+    a.Absolute(0x8D, 0x0200);
+
+    a.Absolute(0xAD, 0x2002);                 // Reset the address latch
+    a.Emit({ 0xA5, 0x02 });
+    a.Absolute(0x8D, 0x2005);                 // Scroll x = frame
+    a.Emit({ 0xA5, 0x01 });
+    a.Absolute(0x8D, 0x2005);                 // Scroll y = input
+    a.Emit({ 0xA5, 0x02, 0x29, 0x3B, 0x09, 0x80 }); // Name table, pattern tables, 8x16
+    a.Absolute(0x8D, 0x2000);
+    a.Emit({ 0xA5, 0x02, 0x4A, 0x29, 0xE7, 0x09, 0x18 }); // Grey, left column, emphasis
+    a.Absolute(0x8D, 0x2001);
+
+    a.Emit({ 0xA0, 0x08 });                   // Wait into the visible frame
+    uint16_t delay = a.Here();
+    a.Emit({ 0xA2, 0x00, 0xCA, 0xD0, 0xFD, 0x88 }); // LDX #0; DEX; BNE; DEY
+    a.Branch(0xD0, delay);
+    a.Emit({ 0xA6, 0x02, 0xCA, 0xD0, 0xFD }); // A frame dependent part
+
+    a.Emit({ 0xA2, 0x40 });                   // Poll for sprite 0 hit
+    uint16_t poll = a.Here();
+    a.Absolute(0x2C, 0x2002);
+    size_t hit = a.Forward(0x70);             // BVS hit
+    a.Emit({ 0xCA });
+    a.Branch(0xD0, poll);
+    a.Land(hit);
+    a.Absolute(0xAD, 0x2002);
+    a.Emit({ 0x29, 0x60, 0x05, 0x03, 0x85, 0x03 }); // Keep hit and overflow in $03
+
+    a.Emit({ 0xA5, 0x02 });
+    a.Absolute(0x8D, 0x2006);
+    a.Emit({ 0xA5, 0x01 });
+    a.Absolute(0x8D, 0x2006);                 // Mid-line address change
+    a.Emit({ 0xA5, 0x00 });
+    a.Absolute(0x8D, 0x2005);                 // Fine x
+    a.Emit({ 0xA2, 0x10, 0xCA, 0xD0, 0xFD }); // A few dots later
+    a.Emit({ 0xA5, 0x01, 0x29, 0x13, 0x09, 0x80 });
+    a.Absolute(0x8D, 0x2000);
+    a.Emit({ 0xA9, 0x1E });
+    a.Absolute(0x8D, 0x2001);
+    a.Emit({ 0x68, 0xA8, 0x68, 0xAA, 0x68, 0x40 }); // PLA; TAY; PLA; TAX; PLA; RTI
+
+    std::vector<uint8_t> prg(16384, 0xEA);
+    std::memcpy(prg.data(), a.Code().data(), a.Code().size());
+    SetVectors(prg, nmi, reset, nmi);
+    return WriteROM("nes_tests_render.nes", prg, {}, 0, 0x01);
+}
+
+static uint8_t Input(int frame) {
+    return (uint8_t)((frame * 37) ^ (frame >> 3));
+}
+
+static void RunFrames(NES& nes, int first, int count) {
+    for (int frame = first; frame < first + count; frame++) {
+        nes.controller1.SetButtonStates(Input(frame));
+        nes.RunFrame();
+    }
+}
+
+static std::vector<uint8_t> State(NES& nes) {
+    std::vector<uint8_t> state(nes.StateSize());
+    nes.SaveState(state.data(), state.size());
+    return state;
+}
+
+static bool SameFrame(NES& a, NES& b) {
+    return std::memcmp(a.ppu.GetFrameBuffer(), b.ppu.GetFrameBuffer(), 256 * 240 * sizeof(uint32_t)) == 0;
+}
+
+static bool SameCPU(const CPU& a, const CPU& b) {
+    return a.A == b.A && a.X == b.X && a.Y == b.Y && a.SP == b.SP && a.PC == b.PC && a.P == b.P &&
+           a.cycles == b.cycles && a.clockCount == b.clockCount;
+}
+
+// Runs code from RAM at $0400 until it reaches its final JMP-to-self
+static void RunFromRAM(NES& nes, Assembler& a) {
+    uint16_t end = a.Here();
+    a.Absolute(0x4C, end);                    // JMP end
+    for (size_t i = 0; i < a.Code().size(); i++) {
+        nes.memory.Write((uint16_t)(0x0400 + i), a.Code()[i]);
+    }
+    nes.cpu.PC = 0x0400;
+    nes.cpu.cycles = 0;
+    for (int i = 0; i < 10000 && nes.cpu.PC != end; i++) {
+        nes.Clock();
+    }
+    CHECK(nes.cpu.PC == end);
+    nes.RunCycles(1);
+}
+
+// The combined unofficial RMW opcodes touch their address once for the
+// read and once for the write, as the plain RMW opcodes do. On $2007 each
+// access moves the VRAM address, so a second read would show up as a skip.
+static void TestUnofficialRMW(const std::string& rom) {
+    const uint8_t opcodes[] = { 0xCF, 0xEF, 0x2F, 0x6F, 0x0F, 0x4F }; // DCP ISB RLA RRA SLO SRE abs
+    for (uint8_t opcode : opcodes) {
+        Cartridge cartridge(rom);
+        CHECK(cartridge.Load());
+        NES nes(&cartridge);
+        nes.Reset();
+
+        Assembler a(0x0400);
+        a.Absolute(0xAD, 0x2002);             // Reset the address latch
+        a.Emit({ 0xA9, 0x21 });
+        a.Absolute(0x8D, 0x2006);
+        a.Emit({ 0xA9, 0x00 });
+        a.Absolute(0x8D, 0x2006);             // $2100
+        a.Absolute(opcode, 0x2007);           // Read $2100, write $2101
+        a.Emit({ 0xA9, 0x77 });
+        a.Absolute(0x8D, 0x2007);             // $2102
+        RunFromRAM(nes, a);
+
+        CHECK(nes.ppu.PPURead(0x2102) == 0x77);
+        CHECK(nes.ppu.PPURead(0x2103) == 0x00);
+    }
+}
+
+// Both renderers draw the same frames from the same machine state. The
+// render ROM covers sprites, sprite 0 hit polling and mid-line scroll and
+// control writes, which send the scanline renderer down its dot path.
+static void TestRenderModesMatch() {
+    std::string rom = WriteRenderROM();
+    Cartridge dotCartridge(rom), lineCartridge(rom);
+    CHECK(dotCartridge.Load() && lineCartridge.Load());
+    NES dot(&dotCartridge), line(&lineCartridge);
+    dot.Reset();
+    line.Reset();
+    dot.ppu.SetRenderMode(PPU::RENDER_DOT);
+    line.ppu.SetRenderMode(PPU::RENDER_SCANLINE);
+
+    for (int frame = 0; frame < 300; frame++) {
+        RunFrames(dot, frame, 1);
+        RunFrames(line, frame, 1);
+        bool same = SameFrame(dot, line) && SameCPU(dot.cpu, line.cpu);
+        CHECK(same);
+        if (!same) {
+            std::printf("Render modes differ at frame %d\n", frame);
+            break;
+        }
+    }
+    CHECK(dot.Running());
+    CHECK((dot.memory.Peek(0x03) & 0x60) == 0x60); // Saw sprite 0 hit and overflow
+
+    std::remove(rom.c_str());
+}
+
+// Save, run, load, run again: the second run must end exactly where the
+// first did, in the same machine and in a fresh one
+static void TestSaveStateReplay(const std::string& rom, PPU::RenderMode mode) {
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    nes.ppu.SetRenderMode(mode);
+    RunFrames(nes, 0, 40);
+    nes.RunCycles(5000); // Mid-frame
+
+    std::vector<uint8_t> saved = State(nes);
+    RunFrames(nes, 40, 30);
+    std::vector<uint8_t> expected = State(nes);
+    std::vector<uint32_t> frame(nes.ppu.GetFrameBuffer(), nes.ppu.GetFrameBuffer() + 256 * 240);
+    CPU cpu = nes.cpu;
+
+    CHECK(nes.LoadState(saved.data(), saved.size()));
+    RunFrames(nes, 40, 30);
+    CHECK(State(nes) == expected);
+    CHECK(SameCPU(nes.cpu, cpu));
+    CHECK(std::memcmp(nes.ppu.GetFrameBuffer(), frame.data(), frame.size() * sizeof(uint32_t)) == 0);
+
+    Cartridge freshCartridge(rom);
+    CHECK(freshCartridge.Load());
+    NES fresh(&freshCartridge);
+    fresh.Reset();
+    fresh.ppu.SetRenderMode(mode);
+    CHECK(fresh.LoadState(saved.data(), saved.size()));
+    RunFrames(fresh, 40, 30);
+    CHECK(State(fresh) == expected);
+    CHECK(SameCPU(fresh.cpu, cpu));
+    CHECK(SameFrame(fresh, nes));
+}
+
+// Corrupt headers and sizes are rejected and leave the machine untouched
+static void TestSaveStateRejects(const std::string& rom) {
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    RunFrames(nes, 0, 20);
+    std::vector<uint8_t> good = State(nes);
+    RunFrames(nes, 20, 5);
+    std::vector<uint8_t> before = State(nes);
+
+    const size_t offsets[] = {
+        offsetof(SaveStateHeader, magic),
+        offsetof(SaveStateHeader, version),
+        offsetof(SaveStateHeader, size),
+        offsetof(SaveStateHeader, romHash),
+    };
+    for (size_t offset : offsets) {
+        std::vector<uint8_t> bad = good;
+        bad[offset] ^= 0x01;
+        CHECK(!nes.LoadState(bad.data(), bad.size()));
+        CHECK(State(nes) == before);
+    }
+
+    CHECK(!nes.LoadState(good.data(), good.size() - 1));
+    CHECK(!nes.LoadState(good.data(), sizeof(SaveStateHeader) - 1));
+    CHECK(State(nes) == before);
+
+    // A valid header over a corrupt body: the body starts with the mapper's
+    // IRQ line (a bool) and mirroring (an enum)
+    const size_t body = sizeof(SaveStateHeader);
+    const uint8_t corruptions[][2] = { { 0, 0x02 }, { 1, 0x05 }, { 1, 0xFF } };
+    for (const uint8_t* corruption : corruptions) {
+        std::vector<uint8_t> bad = good;
+        bad[body + corruption[0]] = corruption[1];
+        CHECK(!nes.LoadState(bad.data(), bad.size()));
+        CHECK(State(nes) == before);
+    }
+
+    // Every body byte in turn: a state is either taken or rejected with
+    // the machine unchanged
+    int rejected = 0;
+    for (size_t offset = body; offset < good.size(); offset++) {
+        std::vector<uint8_t> bad = good;
+        bad[offset] = 0xFF;
+        if (nes.LoadState(bad.data(), bad.size())) {
+            CHECK(nes.LoadState(before.data(), before.size()));
+        }
+        else {
+            rejected++;
+            CHECK(State(nes) == before);
+        }
+    }
+    CHECK(rejected > 0);
+
+    CHECK(nes.SaveState(good.data(), good.size() - 1) == 0);
+
+    CHECK(nes.LoadState(good.data(), good.size()));
+    CHECK(State(nes) == good);
+}
+
+static void TestSharedPages() {
+    SharedPages parent(256, 4);
+    parent.Writable(1)[7] = 0x11;
+    const uint8_t* original = parent.Page(1);
+    {
+        SharedPages child(256, 4);
+        parent.Fork(child);
+        CHECK(child.Page(1) == original && child.Page(1)[7] == 0x11);
+        CHECK(parent.Owners(1) == 2 && child.Owners(1) == 2);
+        {
+            SharedPages grandchild(256, 4);
+            child.Fork(grandchild);
+            CHECK(parent.Owners(1) == 3);
+        }
+        CHECK(parent.Owners(1) == 2);
+
+        // The child's first write copies; the parent keeps its page
+        child.Writable(1)[7] = 0x22;
+        CHECK(child.Page(1) != original);
+        CHECK(parent.Page(1)[7] == 0x11 && child.Page(1)[7] == 0x22);
+        CHECK(parent.Owners(1) == 1 && child.Owners(1) == 1);
+        CHECK(parent.Owners(2) == 2);
+    }
+
+    // With the child gone every page is private again, and writing one
+    // takes no copy
+    for (int i = 0; i < 4; i++) {
+        CHECK(parent.Owners(i) == 1);
+    }
+    const uint8_t* page = parent.Page(2);
+    parent.Writable(2)[0] = 0x33;
+    CHECK(parent.Page(2) == page);
+    CHECK(parent.Page(1) == original);
+
+    // Clear replaces shared pages instead of zeroing them under the child
+    SharedPages child(256, 4);
+    parent.Fork(child);
+    parent.Clear();
+    CHECK(parent.Page(1)[7] == 0 && child.Page(1)[7] == 0x11);
+    CHECK(child.Owners(1) == 1);
+}
+
+static void WriteVRAM(NES& nes, uint16_t address, uint8_t data) {
+    nes.memory.Read(0x2002); // Reset the address latch
+    nes.memory.Write(0x2006, address >> 8);
+    nes.memory.Write(0x2006, address & 0xFF);
+    nes.memory.Write(0x2007, data);
+}
+
+// Writes on either side of a fork stay on that side, for RAM, name tables
+// and CHR RAM, and a fork runs exactly like a machine loaded from a state
+static void TestFork(const std::string& rom) {
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES parent(&cartridge);
+    parent.Reset();
+    RunFrames(parent, 0, 40);
+    parent.RunCycles(5000);
+
+    const uint16_t ram = 0x0345, nameTable = 0x2123, chrRam = 0x0456;
+    uint8_t ramBefore = parent.memory.Peek(ram);
+    uint8_t nameTableBefore = parent.ppu.PPURead(nameTable);
+    uint8_t chrRamBefore = parent.ppu.PPURead(chrRam);
+    {
+        Cartridge childCartridge(cartridge);
+        NES child(&childCartridge);
+        CHECK(parent.Fork(child));
+        std::vector<uint8_t> forked = State(parent);
+        CHECK(State(child) == forked);
+
+        parent.memory.Write(ram, ramBefore ^ 0xFF);
+        WriteVRAM(parent, nameTable, nameTableBefore ^ 0xFF);
+        WriteVRAM(parent, chrRam, chrRamBefore ^ 0xFF);
+        CHECK(parent.memory.Peek(ram) == (uint8_t)(ramBefore ^ 0xFF));
+        CHECK(parent.ppu.PPURead(nameTable) == (uint8_t)(nameTableBefore ^ 0xFF));
+        CHECK(parent.ppu.PPURead(chrRam) == (uint8_t)(chrRamBefore ^ 0xFF));
+        CHECK(child.memory.Peek(ram) == ramBefore);
+        CHECK(child.ppu.PPURead(nameTable) == nameTableBefore);
+        CHECK(child.ppu.PPURead(chrRam) == chrRamBefore);
+
+        // And the other way round, on pages the parent has not touched
+        const uint16_t ram2 = 0x0612, nameTable2 = 0x2701, chrRam2 = 0x1ABC;
+        uint8_t ram2Before = parent.memory.Peek(ram2);
+        uint8_t nameTable2Before = parent.ppu.PPURead(nameTable2);
+        uint8_t chrRam2Before = parent.ppu.PPURead(chrRam2);
+        child.memory.Write(ram2, ram2Before ^ 0x5A);
+        WriteVRAM(child, nameTable2, nameTable2Before ^ 0x5A);
+        WriteVRAM(child, chrRam2, chrRam2Before ^ 0x5A);
+        CHECK(child.memory.Peek(ram2) == (uint8_t)(ram2Before ^ 0x5A));
+        CHECK(child.ppu.PPURead(nameTable2) == (uint8_t)(nameTable2Before ^ 0x5A));
+        CHECK(child.ppu.PPURead(chrRam2) == (uint8_t)(chrRam2Before ^ 0x5A));
+        CHECK(parent.memory.Peek(ram2) == ram2Before);
+        CHECK(parent.ppu.PPURead(nameTable2) == nameTable2Before);
+        CHECK(parent.ppu.PPURead(chrRam2) == chrRam2Before);
+
+        // Refork, then run the child against a machine loaded from the
+        // parent's state
+        CHECK(parent.Fork(child));
+        std::vector<uint8_t> refork = State(parent);
+        Cartridge referenceCartridge(cartridge);
+        NES reference(&referenceCartridge);
+        CHECK(reference.LoadState(refork.data(), refork.size()));
+        RunFrames(child, 40, 30);
+        RunFrames(reference, 40, 30);
+        CHECK(State(child) == State(reference));
+        CHECK(State(parent) == refork);
+    }
+
+    // The parent outlives its child and keeps running normally
+    RunFrames(parent, 40, 10);
+    CHECK(parent.Running());
+
+    // Forks are refused across ROMs and onto the machine itself, and a
+    // refused fork leaves the target as it was
+    std::string otherRom = WriteRenderROM();
+    Cartridge otherCartridge(otherRom);
+    CHECK(otherCartridge.Load());
+    NES other(&otherCartridge);
+    other.Reset();
+    RunFrames(other, 0, 5);
+    std::vector<uint8_t> otherState = State(other);
+    std::vector<uint8_t> parentState = State(parent);
+    CHECK(!parent.Fork(other));
+    CHECK(!other.Fork(parent));
+    CHECK(State(other) == otherState);
+    CHECK(State(parent) == parentState);
+    CHECK(!parent.Fork(parent));
+    CHECK(State(parent) == parentState);
+    std::remove(otherRom.c_str());
+}
+
+static void TestDeltaCodec() {
+    uint32_t random = 12345;
+    auto next = [&random]() {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return random;
+    };
+
+    // Sizes around the word loop and the zero-run threshold, identical,
+    // sparse, dense and fully different inputs
+    const size_t sizes[] = { 0, 1, 7, 8, 9, 17, 100, 13093, 21285 };
+    const int densities[] = { 0, 1, 10, 50, 100 };
+    for (size_t size : sizes) {
+        for (int density : densities) {
+            std::vector<uint8_t> a(size), b(size);
+            for (size_t i = 0; i < size; i++) {
+                a[i] = (uint8_t)next();
+                b[i] = ((int)(next() % 100) < density) ? (uint8_t)(a[i] ^ (next() | 1)) : a[i];
+            }
+            std::vector<uint8_t> delta(Rewind::MaxDeltaSize(size));
+            size_t length = Rewind::Encode(a.data(), b.data(), size, delta.data());
+            CHECK(length <= delta.size());
+
+            std::vector<uint8_t> state = b;
+            Rewind::Apply(delta.data(), length, state.data());
+            CHECK(state == a);
+            Rewind::Apply(delta.data(), length, state.data());
+            CHECK(state == b);
+        }
+    }
+
+    // Worst case for the token overhead: one differing byte between runs
+    // just long enough to end a literal
+    for (size_t gap = 1; gap <= 10; gap++) {
+        const size_t size = 21285;
+        std::vector<uint8_t> a(size, 0), b(size, 0);
+        for (size_t i = 0; i < size; i += gap + 1) {
+            b[i] = 0xFF;
+        }
+        std::vector<uint8_t> delta(Rewind::MaxDeltaSize(size));
+        size_t length = Rewind::Encode(a.data(), b.data(), size, delta.data());
+        CHECK(length <= delta.size());
+        Rewind::Apply(delta.data(), length, b.data());
+        CHECK(a == b);
+    }
+}
+
+// Reading between AddDelta calls of an open frame must give the same
+// samples as reading only after EndFrame, including deltas already added
+// past the samples being read
+static void TestBlipBuffer() {
+    BlipBuffer a, b;
+    a.SetRates(APU::CPU_CLOCK_RATE, 44100);
+    b.SetRates(APU::CPU_CLOCK_RATE, 44100);
+    std::vector<int16_t> outA, outB;
+    int16_t samples[2048];
+    uint32_t random = 1;
+    for (int frame = 0; frame < 20; frame++) {
+        for (uint32_t time = 0; time < 29780; time += 1 + (random % 3000)) {
+            random = random * 1103515245 + 12345;
+            int delta = (int)(random >> 20) - 2048;
+            a.AddDelta(time, delta);
+            b.AddDelta(time, delta);
+            if (time > 15000) {
+                int count = a.ReadSamples(samples, 2048);
+                outA.insert(outA.end(), samples, samples + count);
+            }
+        }
+        a.EndFrame(29780);
+        b.EndFrame(29780);
+        int count = a.ReadSamples(samples, 300); // Leave some for mid-frame
+        outA.insert(outA.end(), samples, samples + count);
+        count = b.ReadSamples(samples, 2048);
+        outB.insert(outB.end(), samples, samples + count);
+    }
+    int count = a.ReadSamples(samples, 2048);
+    outA.insert(outA.end(), samples, samples + count);
+    CHECK(outA.size() > 10000);
+    CHECK(outA == outB);
+}
+
+static void TestAudioRing() {
+    AudioRing ring(1000);
+    CHECK(ring.Capacity() == 1024);
+
+    // Single thread: fill, overflow, then wrap around the end
+    std::vector<int16_t> in(1500), out(1500);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = (int16_t)i;
+    }
+    CHECK(ring.Write(in.data(), 1000) == 1000);
+    CHECK(ring.Write(in.data() + 1000, 100) == 24);
+    CHECK(ring.DroppedSamples() == 76);
+    CHECK(ring.Read(out.data(), 1024) == 1024);
+    CHECK(std::equal(out.begin(), out.begin() + 1024, in.begin()));
+    CHECK(ring.Write(in.data(), 700) == 700);
+    CHECK(ring.Read(out.data(), 800) == 700);
+    CHECK(ring.Underruns() == 1 && ring.UnderrunSamples() == 100);
+    CHECK(std::equal(out.begin(), out.begin() + 700, in.begin()));
+    CHECK(ring.Available() == 0);
+
+    // One producer and one consumer thread with uneven chunk sizes: every
+    // sample arrives once and in order
+    const int total = 1 << 18;
+    AudioRing shared(256);
+    std::thread producer([&shared]() {
+        int16_t chunk[300];
+        int next = 0;
+        for (int size = 1; next < total; size = size % 293 + 7) {
+            int count = std::min(size, total - next);
+            for (int i = 0; i < count; i++) {
+                chunk[i] = (int16_t)(next + i);
+            }
+            int written = (int)shared.Write(chunk, count);
+            if (written == 0) {
+                std::this_thread::yield();
+            }
+            next += written;
+        }
+    });
+    int16_t chunk[300];
+    int received = 0;
+    bool ordered = true;
+    for (int size = 1; received < total; size = size % 289 + 11) {
+        int count = (int)shared.Read(chunk, std::min(size, total - received));
+        for (int i = 0; i < count; i++) {
+            ordered = ordered && chunk[i] == (int16_t)(received + i);
+        }
+        received += count;
+        if (count == 0) {
+            std::this_thread::yield();
+        }
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(received == total);
+    CHECK(shared.Available() == 0);
+}
+
+// Pulse 2 at constant volume 15, period $0FD: a 440 Hz square wave that
+// is loud but does not clip
+static void TestPulseOutput(const std::string& rom) {
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    RunFrames(nes, 0, 10);
+
+    Assembler a(0x0400);
+    const uint8_t writes[][2] = { { 0x15, 0x02 }, { 0x04, 0xBF }, { 0x05, 0x00 }, { 0x06, 0xFD }, { 0x07, 0x00 } };
+    for (const auto& w : writes) {
+        a.Emit({ 0xA9, w[1] });
+        a.Absolute(0x8D, (uint16_t)(0x4000 + w[0]));
+    }
+    int16_t samples[4096];
+    while (nes.apu.ReadSamples(samples, 4096)) {
+    }
+    RunFromRAM(nes, a);
+
+    int total = 0, low = 0, high = 0, crossings = 0;
+    int16_t previous = 0;
+    for (int frame = 0; frame < 60; frame++) {
+        nes.RunFrame();
+        int count = nes.apu.ReadSamples(samples, 4096);
+        for (int i = 0; i < count && frame >= 10; i++) {
+            low = std::min<int>(low, samples[i]);
+            high = std::max<int>(high, samples[i]);
+            crossings += (samples[i] < 0) != (previous < 0);
+            previous = samples[i];
+            total++;
+        }
+    }
+    CHECK(total > 44100 * 50 / 61);
+    CHECK(high - low > 3000);
+    CHECK(low > -8192 && high < 8192);
+    double frequency = crossings / 2.0 * 44100 / total;
+    CHECK(frequency > 420 && frequency < 460);
+}
+
+static void TestRewind(const std::string& rom) {
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    RunFrames(nes, 0, 30);
+
+    // A ring too small for the whole run, so the oldest deltas are dropped
+    Rewind rewind(&nes, 4096, 1);
+    std::vector<std::vector<uint8_t>> states;
+    for (int frame = 30; frame < 130; frame++) {
+        RunFrames(nes, frame, 1);
+        rewind.Capture();
+        states.push_back(State(nes));
+    }
+    CHECK(rewind.BytesUsed() <= rewind.Capacity());
+    CHECK(rewind.Snapshots() >= 2 && rewind.Snapshots() < states.size());
+
+    size_t snapshots = rewind.Snapshots();
+    for (size_t i = 0; i < snapshots; i++) {
+        CHECK(rewind.Step());
+        CHECK(State(nes) == states[states.size() - 1 - i]);
+    }
+
+    // Exhausted: the oldest snapshot stays
+    CHECK(rewind.Step());
+    CHECK(State(nes) == states[states.size() - snapshots]);
+}
+
+// Run-ahead must leave the primary core exactly where a plain core is
+// after the same inputs, and show the frame the plain core draws next. The
+// render ROM changes the picture every frame, so showing the real frame
+// instead would be caught.
+static void TestRunAhead() {
+    std::string rom = WriteRenderROM();
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES plain(&cartridge), single(&cartridge), primary(&cartridge), shadow(&cartridge);
+    RunAhead singleAhead(&single);
+    RunAhead shadowAhead(&primary, &shadow);
+    singleAhead.SetFrames(1);
+    shadowAhead.SetFrames(1);
+    CHECK(singleAhead.Display() == &single);
+    CHECK(shadowAhead.Display() == &shadow);
+    plain.Reset();
+    single.Reset();
+    primary.Reset();
+    shadow.Reset();
+
+    std::vector<uint32_t> singleShown(256 * 240), shadowShown(256 * 240);
+    const size_t frameBytes = 256 * 240 * sizeof(uint32_t);
+    int compared = 0;
+    for (int frame = 0; frame < 240; frame++) {
+        // Inputs held for four frames, so most look-ahead guesses are right
+        uint8_t buttons = Input(frame / 4);
+        plain.controller1.SetButtonStates(buttons);
+        plain.RunFrame();
+        if (frame > 0 && Input((frame - 1) / 4) == buttons) {
+            CHECK(std::memcmp(singleShown.data(), plain.ppu.GetFrameBuffer(), frameBytes) == 0);
+            CHECK(std::memcmp(shadowShown.data(), plain.ppu.GetFrameBuffer(), frameBytes) == 0);
+            compared++;
+        }
+
+        singleAhead.RunFrame(buttons);
+        shadowAhead.RunFrame(buttons);
+        CHECK(State(single) == State(plain));
+        CHECK(State(primary) == State(plain));
+        CHECK(SameCPU(single.cpu, plain.cpu) && SameCPU(primary.cpu, plain.cpu));
+        std::memcpy(singleShown.data(), singleAhead.Display()->ppu.GetFrameBuffer(), frameBytes);
+        std::memcpy(shadowShown.data(), shadowAhead.Display()->ppu.GetFrameBuffer(), frameBytes);
+    }
+    CHECK(compared > 150);
+    std::remove(rom.c_str());
+}
+
+// Loads an MMC1 register the way games do: five writes of bit 0, LSB first
+static void MMC1Write(Assembler& a, uint16_t address, uint8_t value) {
+    a.Emit({ 0xA9, value });                  // LDA #value
+    for (int i = 0; i < 5; i++) {
+        a.Absolute(0x8D, address);            // STA address
+        a.Emit({ 0x4A });                     // LSR A
+    }
+}
+
+// MMC1, 128KB PRG ROM and 32KB CHR ROM with each 16KB PRG bank and 4KB
+// CHR bank starting with its own number. The bank writes run from RAM.
+static void TestMMC1() {
+    std::vector<uint8_t> prg(8 * 16384, 0xEA), chr(8 * 4096, 0);
+    for (int bank = 0; bank < 8; bank++) {
+        prg[bank * 16384] = (uint8_t)bank;
+        chr[bank * 4096] = (uint8_t)(0x40 + bank);
+    }
+    Assembler reset(0xC010);
+    reset.Emit({ 0x78, 0xD8, 0xA2, 0xFF, 0x9A }); // SEI; CLD; LDX #$FF; TXS
+    reset.Absolute(0x4C, reset.Here());           // JMP self
+    std::memcpy(&prg[7 * 16384 + 0x10], reset.Code().data(), reset.Code().size());
+    SetVectors(prg, 0xC010, 0xC010, 0xC010);
+    std::string rom = WriteROM("nes_tests_mmc1.nes", prg, chr, 1, 0x00);
+
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    nes.RunFrame();
+    auto banks = [&nes](int low, int high, int chr0, int chr1) {
+        return nes.memory.Peek(0x8000) == low && nes.memory.Peek(0xC000) == high &&
+               nes.ppu.PPURead(0x0000) == 0x40 + chr0 && nes.ppu.PPURead(0x1000) == 0x40 + chr1;
+    };
+
+    // Power on: PRG mode 3 with the last bank fixed at $C000, 8KB CHR
+    CHECK(banks(0, 7, 0, 1));
+
+    Assembler a(0x0400);
+    MMC1Write(a, 0xE000, 3);
+    RunFromRAM(nes, a);
+    CHECK(banks(3, 7, 0, 1));
+
+    // PRG mode 2 fixes the first bank at $8000; 4KB CHR; horizontal
+    a = Assembler(0x0400);
+    MMC1Write(a, 0x8000, 0x1B);
+    MMC1Write(a, 0xA000, 5);
+    MMC1Write(a, 0xC000, 2);
+    RunFromRAM(nes, a);
+    CHECK(banks(0, 3, 5, 2));
+    CHECK(cartridge.mirror == Cartridge::HORIZONTAL);
+
+    // A write with bit 7 set mid-sequence drops the bits shifted in so
+    // far and returns to PRG mode 3
+    a = Assembler(0x0400);
+    a.Emit({ 0xA9, 0x01 });
+    a.Absolute(0x8D, 0xE000);
+    a.Absolute(0x8D, 0xE000);
+    a.Emit({ 0xA9, 0x80 });
+    a.Absolute(0x8D, 0x8000);
+    RunFromRAM(nes, a);
+    CHECK(banks(3, 7, 5, 2));
+    a = Assembler(0x0400);
+    MMC1Write(a, 0xE000, 6);
+    RunFromRAM(nes, a);
+    CHECK(banks(6, 7, 5, 2));
+
+    // 32KB PRG mode ignores bit 0 of the bank; 8KB CHR mode ignores bit 0
+    // of CHR bank 0 and CHR bank 1 entirely
+    a = Assembler(0x0400);
+    MMC1Write(a, 0x8000, 0x02);
+    MMC1Write(a, 0xE000, 7);
+    RunFromRAM(nes, a);
+    CHECK(banks(6, 7, 4, 5));
+    CHECK(cartridge.mirror == Cartridge::VERTICAL);
+    std::remove(rom.c_str());
+}
+
+// MMC3, 32KB PRG ROM and CHR RAM with rendering on. The NMI reloads the
+// IRQ counter with 20 each frame and the IRQ handler acknowledges and
+// re-enables, so the counter, clocked once per rendered line, raises IRQs
+// on lines 19, 40, 61, ... The lines are worked out from the CPU cycles
+// since the NMI, which comes at dot 1 of line 241.
+static void TestMMC3() {
+    const int latch = 20;
+    Assembler a(0xE000);
+    uint16_t reset = a.Here();
+    a.Emit({ 0x78, 0xD8, 0xA2, 0xFF, 0x9A });  // SEI; CLD; LDX #$FF; TXS
+    for (int i = 0; i < 2; i++) {
+        uint16_t wait = a.Here();
+        a.Absolute(0x2C, 0x2002);             // BIT $2002
+        a.Branch(0x10, wait);                 // BPL wait
+    }
+    a.Emit({ 0xA9, 0x40 });
+    a.Absolute(0x8D, 0x4017);                 // No APU frame IRQ
+    a.Emit({ 0xA9, latch });
+    a.Absolute(0x8D, 0xC000);                 // IRQ latch
+    a.Absolute(0x8D, 0xE001);                 // IRQ enable
+    a.Emit({ 0xA9, 0x80 });
+    a.Absolute(0x8D, 0x2000);                 // NMI on
+    a.Emit({ 0xA9, 0x18 });
+    a.Absolute(0x8D, 0x2001);                 // Rendering on
+    a.Emit({ 0x58 });                         // CLI
+    uint16_t loop = a.Here();
+    a.Absolute(0x4C, loop);                   // JMP loop
+
+    uint16_t nmi = a.Here();
+    a.Absolute(0x8D, 0xC001);                 // Reload the counter
+    a.Emit({ 0xE6, 0x11, 0x40 });             // INC $11; RTI
+
+    uint16_t irq = a.Here();
+    a.Absolute(0x8D, 0xE000);                 // Acknowledge
+    a.Absolute(0x8D, 0xE001);                 // Enable again
+    a.Emit({ 0xE6, 0x10, 0x40 });             // INC $10; RTI
+
+    std::vector<uint8_t> prg(32768, 0xEA);
+    std::memcpy(&prg[0x6000], a.Code().data(), a.Code().size());
+    SetVectors(prg, nmi, reset, irq);
+    std::string rom = WriteROM("nes_tests_mmc3.nes", prg, {}, 4, 0x00);
+
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load());
+    NES nes(&cartridge);
+    nes.Reset();
+    RunFrames(nes, 0, 5);
+
+    // Three frames, one CPU cycle at a time
+    std::vector<int> lines;
+    uint64_t nmiClock = 0;
+    uint16_t lastPC = nes.cpu.PC;
+    int frames = 0;
+    while (frames < 4) {
+        nes.Clock();
+        if (nes.cpu.PC != lastPC && nes.cpu.PC == nmi) {
+            nmiClock = nes.cpu.clockCount;
+            frames++;
+        }
+        else if (nes.cpu.PC != lastPC && nes.cpu.PC == irq && frames > 0 && frames < 4) {
+            int dot = (int)(nes.cpu.clockCount - nmiClock) * 3 + 241 * 341;
+            lines.push_back(dot / 341 - 262);
+        }
+        lastPC = nes.cpu.PC;
+    }
+    const int perFrame = (239 - (latch - 1)) / (latch + 1) + 1;
+    CHECK((int)lines.size() == perFrame * 3);
+    for (size_t i = 0; i < lines.size(); i++) {
+        CHECK(lines[i] == latch - 1 + (int)(i % perFrame) * (latch + 1));
+    }
+
+    // Disabled, or with rendering off, the counter raises no IRQs
+    for (int step = 0; step < 2; step++) {
+        Assembler off(0x0400);
+        if (step == 0) {
+            off.Absolute(0x8D, 0xE000);       // IRQ disable
+        }
+        else {
+            off.Absolute(0x8D, 0xE001);       // IRQ enable
+            off.Emit({ 0xA9, 0x00 });
+            off.Absolute(0x8D, 0x2001);       // Rendering off
+        }
+        RunFromRAM(nes, off);
+        nes.RunFrame();
+        uint8_t count = nes.memory.Peek(0x0010);
+        RunFrames(nes, 0, 3);
+        CHECK(nes.memory.Peek(0x0010) == count);
+    }
+    std::remove(rom.c_str());
+}
+
+static std::string CopyFile(const std::string& from, const std::string& to, long patchOffset = -1) {
+    std::ifstream in(from, std::ios::binary);
+    std::vector<char> bytes((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    if (patchOffset >= 0) {
+        bytes[patchOffset] ^= 0xFF;
+    }
+    std::ofstream out(to, std::ios::binary);
+    out.write(bytes.data(), bytes.size());
+    return to;
+}
+
+// Loads of one file, or of a copy of it under another name, share one
+// image; other contents get their own, and the cache empties with the
+// last cartridge
+static void TestRomImageSharing(const std::string& rom) {
+    std::string copy = CopyFile(rom, "nes_tests_copy.nes");
+    std::string other = CopyFile(rom, "nes_tests_other.nes", 16 + 0x100);
+    CHECK(RomImage::CachedImages() == 0);
+    {
+        std::shared_ptr<const RomImage> image = RomImage::Load(rom);
+        CHECK(image && RomImage::Load(rom) == image);
+        CHECK(RomImage::Load(copy) == image);
+        CHECK(RomImage::CachedImages() == 1);
+
+        Cartridge second(copy), third(other);
+        CHECK(second.Load() && third.Load());
+        CHECK(second.PRG_ROM.data() == image->PRG());
+        CHECK(third.PRG_ROM.data() != image->PRG() && third.romHash != second.romHash);
+        CHECK(RomImage::CachedImages() == 2);
+
+        // A copy of a cartridge keeps the image alive on its own
+        std::unique_ptr<Cartridge> copied;
+        {
+            Cartridge first(rom);
+            CHECK(first.Load() && first.PRG_ROM.data() == image->PRG());
+            copied.reset(new Cartridge(first));
+        }
+        image.reset();
+        CHECK(RomImage::CachedImages() == 2);
+        CHECK(copied->PRG_ROM.data() == second.PRG_ROM.data());
+    }
+    CHECK(RomImage::CachedImages() == 0);
+    std::remove(copy.c_str());
+    std::remove(other.c_str());
+}
+
+// A cartridge without a mapper (its Load() failed or never ran) gives a
+// halted machine that is safe to drive, so a batch of them reports every
+// core done, and the scheduler refuses the session
+static void TestUnloadedCartridge(const std::string& rom) {
+    Cartridge missing("nes_tests_missing.nes");
+    CHECK(!missing.Load() && !missing.Loaded());
+    Cartridge unloaded(rom);
+    CHECK(!unloaded.Loaded() && !Cartridge(unloaded).Loaded());
+    for (Cartridge* cartridge : {&missing, &unloaded}) {
+        NES nes(cartridge);
+        CHECK(!nes.Running());
+        nes.Reset();
+        nes.Clock();
+        nes.RunCycles(100);
+        nes.RunFrame();
+        CHECK(!nes.Running());
+        std::vector<uint8_t> state = State(nes);
+        CHECK(nes.LoadState(state.data(), state.size()));
+        NES child(cartridge);
+        CHECK(nes.Fork(child));
+        CHECK(!child.Running());
+    }
+
+    BatchEnv::Config config;
+    config.threads = 2;
+    uint8_t actions[4] = {};
+    for (Cartridge* cartridge : {&missing, &unloaded}) {
+        BatchEnv env(*cartridge, 4, config);
+        env.Step(actions);
+        CHECK(env.Count() == 4);
+        for (int i = 0; i < env.Count(); i++) {
+            CHECK(env.Done()[i] == 1);
+        }
+    }
+
+    Cartridge cartridge(rom);
+    CHECK(cartridge.Load() && cartridge.Loaded() && Cartridge(cartridge).Loaded());
+    BatchEnv env(cartridge, 4, config);
+    env.Step(actions);
+    CHECK(env.Count() == 4);
+    for (int i = 0; i < env.Count(); i++) {
+        CHECK(env.Done()[i] == 0);
+    }
+
+    SessionScheduler::Config schedulerConfig;
+    schedulerConfig.threads = 2;
+    schedulerConfig.pinThreads = false;
+    SessionScheduler scheduler(schedulerConfig);
+    CHECK(scheduler.Add(missing, 10) == -1);
+    CHECK(scheduler.Add(Cartridge(rom), 10) == -1);
+    CHECK(scheduler.Add(cartridge, 10) == 0);
+    CHECK(scheduler.Sessions() == 1);
+    scheduler.Run();
+    CHECK(scheduler.Stats(0).frames == 10);
+}
+
+int main() {
+    std::string rom = WriteTestROM();
+
+    TestUnofficialRMW(rom);
+    TestDeltaCodec();
+    TestRewind(rom);
+    TestRunAhead();
+    TestMMC1();
+    TestMMC3();
+    TestSaveStateReplay(rom, PPU::RENDER_SCANLINE);
+    TestSaveStateReplay(rom, PPU::RENDER_DOT);
+    TestSaveStateRejects(rom);
+    TestRenderModesMatch();
+    TestSharedPages();
+    TestFork(rom);
+    TestUnloadedCartridge(rom);
+    TestRomImageSharing(rom);
+    TestBlipBuffer();
+    TestAudioRing();
+    TestPulseOutput(rom);
+
+    std::remove(rom.c_str());
+    if (failures) {
+        std::printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,131 @@
+// tracedump.cpp
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include "Trace.h"
+
+// Offline decoder for binary CPU traces written by TraceWriter. Prints one
+// nestest-style line per instruction:
+//   C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD CYC:7
+// Usage: nes_tracedump <trace.bin> [output.log]
+
+enum AddrMode { IMP, ACC, IMM, ZP, ZPX, ZPY, REL, ABS, ABX, ABY, IND, IZX, IZY };
+
+struct OpInfo {
+    const char* name;
+    AddrMode mode;
+    bool official; // Unofficial opcodes are prefixed with '*' like nestest.log
+};
+
+// Names and modes come from the CPU's own opcode table
+static constexpr std::array<OpInfo, 256> BuildOpTable() {
+    std::array<OpInfo, 256> table{};
+
+#define OPCODE(code, name, operate, mode, cycles) table[code] = { name, mode, true };
+#define UNOFFICIAL(code, name, operate, mode, cycles) table[code] = { name, mode, false };
+#include "CPUOpcodes.inc"
+#undef UNOFFICIAL
+#undef OPCODE
+
+    return table;
+}
+
+static constexpr std::array<OpInfo, 256> opTable = BuildOpTable();
+
+static int OperandLength(AddrMode mode) {
+    switch (mode) {
+    case IMP:
+    case ACC:
+        return 0;
+    case ABS:
+    case ABX:
+    case ABY:
+    case IND:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+static void Disassemble(const TraceRecord& r, char* out, size_t size) {
+    const OpInfo& op = opTable[r.opcode];
+    uint8_t lo = r.operand[0];
+    uint16_t word = (uint16_t)(r.operand[1] << 8) | lo;
+    const char* prefix = op.official ? " " : "*";
+
+    switch (op.mode) {
+    case IMP: snprintf(out, size, "%s%s", prefix, op.name); break;
+    case ACC: snprintf(out, size, "%s%s A", prefix, op.name); break;
+    case IMM: snprintf(out, size, "%s%s #$%02X", prefix, op.name, lo); break;
+    case ZP:  snprintf(out, size, "%s%s $%02X", prefix, op.name, lo); break;
+    case ZPX: snprintf(out, size, "%s%s $%02X,X", prefix, op.name, lo); break;
+    case ZPY: snprintf(out, size, "%s%s $%02X,Y", prefix, op.name, lo); break;
+    case REL: snprintf(out, size, "%s%s $%04X", prefix, op.name, (uint16_t)(r.pc + 2 + (int8_t)lo)); break;
+    case ABS: snprintf(out, size, "%s%s $%04X", prefix, op.name, word); break;
+    case ABX: snprintf(out, size, "%s%s $%04X,X", prefix, op.name, word); break;
+    case ABY: snprintf(out, size, "%s%s $%04X,Y", prefix, op.name, word); break;
+    case IND: snprintf(out, size, "%s%s ($%04X)", prefix, op.name, word); break;
+    case IZX: snprintf(out, size, "%s%s ($%02X,X)", prefix, op.name, lo); break;
+    case IZY: snprintf(out, size, "%s%s ($%02X),Y", prefix, op.name, lo); break;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <trace.bin> [output.log]\n", argv[0]);
+        return 1;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (!in) {
+        printf("Could not open trace file: %s\n", argv[1]);
+        return 1;
+    }
+
+    TraceFileHeader header;
+    if (fread(&header, sizeof(header), 1, in) != 1 ||
+        std::memcmp(header.magic, "NESTRACE", 8) != 0) {
+        printf("Invalid trace file.\n");
+        fclose(in);
+        return 1;
+    }
+    if (header.version != TRACE_FILE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+        printf("Unsupported trace version %u (record size %u).\n", header.version, header.recordSize);
+        fclose(in);
+        return 1;
+    }
+
+    FILE* out = stdout;
+    if (argc > 2) {
+        out = fopen(argv[2], "w");
+        if (!out) {
+            printf("Could not open output file: %s\n", argv[2]);
+            fclose(in);
+            return 1;
+        }
+    }
+
+    static TraceRecord records[4096];
+    size_t count;
+    while ((count = fread(records, sizeof(TraceRecord), 4096, in)) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            const TraceRecord& r = records[i];
+            int length = OperandLength(opTable[r.opcode].mode);
+
+            char bytes[16];
+            if (length == 0) snprintf(bytes, sizeof(bytes), "%02X", r.opcode);
+            else if (length == 1) snprintf(bytes, sizeof(bytes), "%02X %02X", r.opcode, r.operand[0]);
+            else snprintf(bytes, sizeof(bytes), "%02X %02X %02X", r.opcode, r.operand[0], r.operand[1]);
+
+            char text[48];
+            Disassemble(r, text, sizeof(text));
+
+            fprintf(out, "%04X  %-9s%-33sA:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu\n",
+                r.pc, bytes, text, r.a, r.x, r.y, r.p, r.sp, (unsigned long long)r.cycle);
+        }
+    }
+
+    if (out != stdout) fclose(out);
+    fclose(in);
+    return 0;
+}